@@ -0,0 +1,777 @@
+/*
+ * libmulticam benchmark: conversion paths and end-to-end camsys reads.
+ *
+ * Cameras are simulated by a fake V4L2 driver behind /dev/null: the binary
+ * is linked with -Wl,--wrap=ioctl,--wrap=mmap,--wrap=poll, so libmulticam runs
+ * its real capture path (open, S_FMT, mmap, poll, QBUF/DQBUF, convert) on
+ * generated sample frames. Results are written as JSON.
+ *
+ *   make bench && build/multicam_bench -o bench.json
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <linux/videodev2.h>
+#include <jpeglib.h>
+#include "libmulticam.h"
+
+#ifndef MC_BENCH_VERSION
+#define MC_BENCH_VERSION "unknown"
+#endif
+
+#define SIM_DEVICE "/dev/null"
+#define SIM_MAX_FD 1024
+#define SIM_MAX_BUFFERS 8
+#define MAX_SAMPLES 20000
+
+/*
+ * Simulated V4L2 driver
+ */
+typedef struct SimCamera {
+    int active;
+    unsigned int n_buffers;
+    size_t length;              /* Bytes per buffer */
+    uint64_t t0_us, period_us;  /* Frame k is captured at t0 + k*period; free running if period is 0 */
+    uint32_t produced;          /* Next frame number */
+    int empty[SIM_MAX_BUFFERS]; /* Queued buffers waiting for a frame (FIFO) */
+    int n_empty;
+    struct { int index; uint64_t ts; uint32_t seq; } done[SIM_MAX_BUFFERS]; /* Filled buffers (FIFO) */
+    int n_done;
+} SimCamera;
+
+static SimCamera sims[SIM_MAX_FD];
+static const uint8_t *sim_sample;   /* Sample frame copied into every buffer */
+static size_t sim_sample_size;
+static float sim_fps;               /* 0: deliver frames as fast as they are dequeued */
+
+int __real_ioctl(int fd, unsigned long request, void *arg);
+void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+static uint64_t
+now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+sleep_until_us(uint64_t t)
+{
+    struct timespec ts = {(time_t) (t / 1000000), (long) (t % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/* Fill queued buffers with the frames captured up to `now`; frames without a free buffer are dropped */
+static void
+sim_advance(SimCamera *s, uint64_t now)
+{
+    while (s->t0_us + (uint64_t) s->produced * s->period_us <= now) {
+        if (s->n_empty) {
+            s->done[s->n_done].index = s->empty[0];
+            s->done[s->n_done].ts = s->t0_us + (uint64_t) s->produced * s->period_us;
+            s->done[s->n_done].seq = s->produced;
+            s->n_done++;
+            memmove(s->empty, s->empty + 1, --s->n_empty * sizeof(int));
+        }
+        s->produced++;
+    }
+}
+
+static int
+sim_dqbuf(SimCamera *s, struct v4l2_buffer *buf)
+{
+    uint64_t ts;
+
+    if (!s->period_us) { //Free running: a frame is captured whenever a buffer is dequeued
+        if (!s->n_empty) { errno = EIO; return -1; }
+        buf->index = s->empty[0];
+        memmove(s->empty, s->empty + 1, --s->n_empty * sizeof(int));
+        ts = now_us();
+        buf->sequence = s->produced++;
+    }
+    else {
+        sim_advance(s, now_us());
+        while (!s->n_done) {
+            if (!s->n_empty) { errno = EIO; return -1; } //Would block forever
+            sleep_until_us(s->t0_us + (uint64_t) s->produced * s->period_us);
+            sim_advance(s, now_us());
+        }
+        buf->index = s->done[0].index;
+        buf->sequence = s->done[0].seq;
+        ts = s->done[0].ts;
+        memmove(s->done, s->done + 1, --s->n_done * sizeof(s->done[0]));
+    }
+    buf->timestamp.tv_sec = ts / 1000000;
+    buf->timestamp.tv_usec = ts % 1000000;
+    buf->bytesused = sim_sample_size;
+    buf->length = s->length;
+    buf->flags = V4L2_BUF_FLAG_MAPPED;
+    return 0;
+}
+
+int
+__wrap_ioctl(int fd, unsigned long request, void *arg)
+{
+    SimCamera *s = (fd >= 0 && fd < SIM_MAX_FD) ? &sims[fd] : NULL;
+    unsigned int req = (unsigned int) request; //v4l2_xioctl() passes the request as a (sign extended) int
+
+    if (s && req == VIDIOC_QUERYCAP) { //Every camera of the benchmark is simulated
+        struct v4l2_capability *cap = arg;
+        memset(s, 0, sizeof(*s));
+        s->active = 1;
+        memset(cap, 0, sizeof(*cap));
+        strcpy((char *) cap->driver, "multicam_bench");
+        cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING | V4L2_CAP_DEVICE_CAPS;
+        cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+        return 0;
+    }
+    if (!s || !s->active) return __real_ioctl(fd, request, arg);
+
+    switch (req) {
+        case VIDIOC_S_FMT: {
+            struct v4l2_format *fmt = arg; //Any size and format, the sample frame matches
+            fmt->fmt.pix.sizeimage = sim_sample_size;
+            return 0;
+        }
+        case VIDIOC_S_PARM:
+            return 0;
+        case VIDIOC_REQBUFS: {
+            struct v4l2_requestbuffers *req = arg;
+            long page = sysconf(_SC_PAGESIZE);
+            if (req->count > SIM_MAX_BUFFERS) req->count = SIM_MAX_BUFFERS;
+            s->n_buffers = req->count;
+            s->length = (sim_sample_size + page - 1) / page * page;
+            return 0;
+        }
+        case VIDIOC_QUERYBUF: {
+            struct v4l2_buffer *buf = arg;
+            if (buf->index >= s->n_buffers) { errno = EINVAL; return -1; }
+            buf->length = s->length;
+            buf->m.offset = buf->index * s->length;
+            return 0;
+        }
+        case VIDIOC_QBUF: {
+            struct v4l2_buffer *buf = arg;
+            if (buf->index >= s->n_buffers || s->n_empty == SIM_MAX_BUFFERS) { errno = EINVAL; return -1; }
+            s->empty[s->n_empty++] = buf->index;
+            return 0;
+        }
+        case VIDIOC_DQBUF:
+            return sim_dqbuf(s, arg);
+        case VIDIOC_STREAMON:
+            s->period_us = (sim_fps > 0) ? (uint64_t) (1e6 / sim_fps) : 0;
+            s->t0_us = now_us();
+            s->produced = 1;
+            return 0;
+        case VIDIOC_STREAMOFF:
+            s->n_empty = s->n_done = 0;
+            return 0;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/* Buffers of simulated cameras are anonymous memory holding the sample frame */
+void *
+__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    void *p;
+
+    if (fd < 0 || fd >= SIM_MAX_FD || !sims[fd].active)
+        return __real_mmap(addr, length, prot, flags, fd, offset);
+    p = __real_mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) memcpy(p, sim_sample, sim_sample_size < length ? sim_sample_size : length);
+    return p;
+}
+
+/* A filled buffer can be dequeued without blocking (free running: any queued buffer) */
+static int
+sim_ready(SimCamera *s, uint64_t now)
+{
+    if (!s->period_us) return s->n_empty > 0;
+    sim_advance(s, now);
+    return s->n_done > 0;
+}
+
+/* Like a V4L2 driver, simulated cameras are readable once a frame is captured */
+int
+__wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    uint64_t now = now_us(), deadline = now + (uint64_t) timeout * 1000, next;
+    int ready;
+
+    for (nfds_t i=0; i<nfds; i++) {
+        if (fds[i].fd < 0 || fds[i].fd >= SIM_MAX_FD || !sims[fds[i].fd].active)
+            return __real_poll(fds, nfds, timeout);
+    }
+    for (;;) {
+        ready = 0;
+        next = 0;
+        for (nfds_t i=0; i<nfds; i++) {
+            SimCamera *s = &sims[fds[i].fd];
+            fds[i].revents = sim_ready(s, now) ? (fds[i].events & POLLIN) : 0;
+            if (fds[i].revents) ready++;
+            else if (s->period_us && s->n_empty &&
+                     (!next || s->t0_us + (uint64_t) s->produced * s->period_us < next))
+                next = s->t0_us + (uint64_t) s->produced * s->period_us;
+        }
+        if (ready || timeout == 0 || (timeout > 0 && now >= deadline)) return ready;
+        if (!next) { //No buffer queued: nothing will be captured
+            if (timeout < 0) { errno = EINVAL; return -1; }
+            next = deadline;
+        }
+        sleep_until_us((timeout > 0 && deadline < next) ? deadline : next);
+        now = now_us();
+    }
+}
+
+/*
+ * Sample frames: a deterministic test pattern (gradients, edges and some
+ * texture, so MJPG compresses like a camera image) in each capture format.
+ */
+static const char *FORMATS[] = {"MJPG", "YUYV", "UYVY", "NV12", "NV21", "YU12", "YV12", "RGB3", "BGR3", "GREY"};
+
+static void
+pattern_rgb(uint8_t *rgb, int width, int height)
+{
+    uint32_t seed = 12345;
+    for (int y=0; y<height; y++) {
+        for (int x=0; x<width; x++, rgb+=3) {
+            int cx = x - width/2, cy = y - height/2;
+            seed = seed * 1103515245 + 12345;
+            int noise = (int) ((seed >> 16) & 15) - 8;
+            int ring = (((cx*cx + cy*cy) >> 9) & 1) ? 40 : 0;
+            int r = x * 255 / width + noise, g = y * 255 / height + ring + noise, b = ((x ^ y) & 0x20) ? 200 : 60;
+            rgb[0] = (uint8_t) (r < 0 ? 0 : r > 255 ? 255 : r);
+            rgb[1] = (uint8_t) (g < 0 ? 0 : g > 255 ? 255 : g);
+            rgb[2] = (uint8_t) b;
+        }
+    }
+}
+
+/* BT.601 limited range, as libyuv */
+static inline uint8_t rgb_y(const uint8_t *p) { return (uint8_t) (((66*p[0] + 129*p[1] + 25*p[2] + 128) >> 8) + 16); }
+static inline uint8_t rgb_u(const uint8_t *p) { return (uint8_t) (((-38*p[0] - 74*p[1] + 112*p[2] + 128) >> 8) + 128); }
+static inline uint8_t rgb_v(const uint8_t *p) { return (uint8_t) (((112*p[0] - 94*p[1] - 18*p[2] + 128) >> 8) + 128); }
+
+static size_t
+encode_jpeg(const uint8_t *rgb, int width, int height, uint8_t **out)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned long size = 0;
+
+    *out = NULL;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, out, &size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2; //4:2:2, as UVC cameras
+    cinfo.comp_info[0].v_samp_factor = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW) &rgb[(size_t) cinfo.next_scanline * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return size;
+}
+
+/* Sample frame of `format`; returns its size, or 0 if the format or size is not supported */
+static size_t
+make_sample(const char *format, int width, int height, uint8_t **out)
+{
+    size_t npix = (size_t) width * height, size = 0;
+    uint8_t *rgb = malloc(npix * 3), *d = NULL;
+
+    *out = NULL;
+    if (!rgb) return 0;
+    pattern_rgb(rgb, width, height);
+    if (!strcmp(format, "MJPG")) {
+        uint8_t *jpeg;
+        size = encode_jpeg(rgb, width, height, &jpeg);
+        if ((d = malloc(size))) memcpy(d, jpeg, size);
+        free(jpeg);
+    }
+    else if (!strcmp(format, "YUYV") || !strcmp(format, "UYVY")) {
+        int uyvy = (format[0] == 'U');
+        if (width % 2 == 0 && (d = malloc(size = npix * 2))) {
+            for (size_t i=0; i<npix; i+=2) {
+                const uint8_t *p = &rgb[i*3];
+                uint8_t *q = &d[i*2];
+                q[uyvy] = rgb_y(p); q[2 + uyvy] = rgb_y(p + 3);
+                q[1 - uyvy] = rgb_u(p); q[3 - uyvy] = rgb_v(p);
+            }
+        }
+    }
+    else if (!strcmp(format, "NV12") || !strcmp(format, "NV21") || !strcmp(format, "YU12") || !strcmp(format, "YV12")) {
+        int cw = width / 2, ch = height / 2;
+        if (width % 2 == 0 && height % 2 == 0 && (d = malloc(size = npix + 2 * (size_t) cw * ch))) {
+            uint8_t *uv = d + npix;
+            for (size_t i=0; i<npix; i++) d[i] = rgb_y(&rgb[i*3]);
+            for (int y=0; y<ch; y++) {
+                for (int x=0; x<cw; x++) {
+                    const uint8_t *p = &rgb[((size_t) 2*y * width + 2*x) * 3];
+                    size_t i = (size_t) y * cw + x;
+                    uint8_t u = rgb_u(p), v = rgb_v(p);
+                    if (format[0] == 'N') { //Interleaved chroma
+                        uv[2*i + (format[3] == '1')] = u;
+                        uv[2*i + (format[3] != '1')] = v;
+                    }
+                    else { //Planar; YV12 has V first
+                        uv[i + (format[1] == 'V') * (size_t) cw * ch] = u;
+                        uv[i + (format[1] == 'U') * (size_t) cw * ch] = v;
+                    }
+                }
+            }
+        }
+    }
+    else if (!strcmp(format, "RGB3") || !strcmp(format, "BGR3")) {
+        if ((d = malloc(size = npix * 3))) {
+            for (size_t i=0; i<npix; i++) {
+                d[3*i] = rgb[3*i + (format[0] == 'B' ? 2 : 0)];
+                d[3*i + 1] = rgb[3*i + 1];
+                d[3*i + 2] = rgb[3*i + (format[0] == 'B' ? 0 : 2)];
+            }
+        }
+    }
+    else if (!strcmp(format, "GREY")) {
+        if ((d = malloc(size = npix)))
+            for (size_t i=0; i<npix; i++) d[i] = rgb_y(&rgb[i*3]);
+    }
+    free(rgb);
+    *out = d;
+    return d ? size : 0;
+}
+
+/*
+ * JSON output
+ */
+static FILE *out;
+static int out_first;
+
+static void
+json_string(const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* Start a result object in the current array */
+static void
+json_item(void)
+{
+    fprintf(out, out_first ? "\n    {" : ",\n    {");
+    out_first = 0;
+}
+
+static void
+json_host(void)
+{
+    char line[256], cpu[256] = "unknown";
+    struct utsname u;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            char *v = strchr(line, ':');
+            if (!strncmp(line, "model name", 10) && v) {
+                snprintf(cpu, sizeof(cpu), "%s", v + 2);
+                cpu[strcspn(cpu, "\n")] = 0;
+                break;
+            }
+        }
+        fclose(f);
+    }
+    uname(&u);
+    fprintf(out, "  \"version\": ");
+    json_string(MC_BENCH_VERSION);
+    fprintf(out, ",\n  \"host\": {\"cpu\": ");
+    json_string(cpu);
+    fprintf(out, ", \"cpus\": %ld, \"kernel\": ", sysconf(_SC_NPROCESSORS_ONLN));
+    json_string(u.release);
+    fprintf(out, ", \"machine\": ");
+    json_string(u.machine);
+    fprintf(out, ", \"compiler\": ");
+    json_string(__VERSION__);
+    fprintf(out, "}");
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Mean, median, 99th percentile and max of `n` samples (sorted in place) */
+static void
+json_stats(const char *name, double *v, int n)
+{
+    double sum = 0;
+    if (!n) return;
+    qsort(v, n, sizeof(double), cmp_double);
+    for (int i=0; i<n; i++) sum += v[i];
+    fprintf(out, ", \"%s\": {\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+            name, sum / n, v[n / 2], v[(int) (0.99 * (n - 1))], v[n - 1]);
+}
+
+/*
+ * Benchmarks
+ */
+typedef enum Variant { VARIANT_DIRECT, VARIANT_REMAP, VARIANT_MOSAIC } Variant;
+static const char *VARIANTS[] = {"direct", "remap", "mosaic"};
+
+typedef struct Rig {
+    int n;
+    mc_camera *cams;
+    mc_camera **ptrs;
+    mc_remap remap;
+    mc_mosaic mosaic;
+    uint8_t *dst;
+    size_t dst_size;
+    mc_frame_info *info;
+    char error[MC_ERRMSG_LEN];
+} Rig;
+
+static void
+rig_destroy(Rig *r)
+{
+    for (int i=0; i<r->n; i++) mc_cam_destroy(&r->cams[i]);
+    mc_remap_destroy(&r->remap);
+    mc_mosaic_destroy(&r->mosaic);
+    free(r->cams);
+    free(r->ptrs);
+    free(r->dst);
+    free(r->info);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Mosaic of half size tiles in a row, with a 4 pixel border drawn by the overlay */
+static int
+rig_mosaic(Rig *r, int width, int height)
+{
+    const int b = 4, tw = width / 2, th = height / 2;
+    int mw = r->n * (tw + b) + b, mh = th + 2*b, res;
+    mc_tile tiles[r->n];
+    uint8_t *overlay, *mask;
+
+    for (int i=0; i<r->n; i++) tiles[i] = (mc_tile){b + i * (tw + b), b, tw, th};
+    if ((res = mc_mosaic_init(&r->mosaic, mw, mh, r->n, tiles)) != MC_OK) return res;
+    overlay = malloc((size_t) mw * mh * 3);
+    mask = malloc((size_t) mw * mh);
+    if (!overlay || !mask) {
+        free(overlay);
+        free(mask);
+        return MC_ERR_MEMORY;
+    }
+    memset(overlay, 255, (size_t) mw * mh * 3);
+    memset(mask, 1, (size_t) mw * mh);
+    for (int i=0; i<r->n; i++)
+        for (int y=0; y<th; y++)
+            memset(&mask[(size_t) (b + y) * mw + tiles[i].x], 0, tw);
+    res = mc_mosaic_set_overlay(&r->mosaic, overlay, mask);
+    free(overlay);
+    free(mask);
+    return res;
+}
+
+/* Start `n` simulated cameras streaming `format` */
+static int
+rig_init(Rig *r, int n, const char *format, int width, int height, float fps, Variant variant)
+{
+    static const double D[5] = {-0.25, 0.08, 0, 0, 0};
+    double K[9] = {0.9 * width, 0, width / 2.0, 0, 0.9 * width, height / 2.0, 0, 0, 1};
+    int res = MC_OK;
+
+    memset(r, 0, sizeof(*r));
+    r->cams = calloc(n, sizeof(mc_camera));
+    r->ptrs = calloc(n, sizeof(mc_camera *));
+    r->info = calloc(n, sizeof(mc_frame_info));
+    if (!r->cams || !r->ptrs || !r->info) goto ERR_MEMORY;
+    if (variant == VARIANT_REMAP && (res = mc_remap_init_calib(&r->remap, width, height, K, D, NULL, NULL)) != MC_OK) {
+        snprintf(r->error, sizeof(r->error), "mc_remap_init_calib: %s", mc_strerror(res));
+        return res;
+    }
+    for (int i=0; i<n; i++) {
+        mc_camera *cam = &r->cams[i];
+        r->ptrs[i] = cam;
+        r->n = i + 1;
+        if ((res = mc_cam_init(cam, SIM_DEVICE)) != MC_OK ||
+            (res = mc_cam_configure(cam, width, height, format, fps > 0 ? fps : 30)) != MC_OK ||
+            (variant == VARIANT_REMAP && (res = mc_cam_set_remap(cam, &r->remap)) != MC_OK) ||
+            (res = mc_cam_start(cam)) != MC_OK) {
+            snprintf(r->error, sizeof(r->error), "%s", mc_cam_error(cam));
+            return res;
+        }
+    }
+    if (variant == VARIANT_MOSAIC) {
+        if ((res = rig_mosaic(r, width, height)) != MC_OK) {
+            snprintf(r->error, sizeof(r->error), "mosaic: %s", mc_strerror(res));
+            return res;
+        }
+        r->dst_size = mc_mosaic_size(&r->mosaic);
+    }
+    else
+        r->dst_size = (size_t) n * mc_cam_frame_size(&r->cams[0]);
+    if (!(r->dst = calloc(1, r->dst_size))) goto ERR_MEMORY;
+    return MC_OK;
+
+    ERR_MEMORY:
+    snprintf(r->error, sizeof(r->error), "Out of memory");
+    return MC_ERR_MEMORY;
+}
+
+/* One read of all cameras of the rig. A single camera is read directly, without a worker thread. */
+static int
+rig_read(Rig *r)
+{
+    int res, failed = -1;
+
+    if (r->mosaic.n)
+        res = mc_camsys_read_mosaic(r->ptrs, NULL, r->n, &r->mosaic, r->dst, -1, r->info, &failed);
+    else if (r->n == 1)
+        res = mc_cam_read(&r->cams[0], r->dst, r->info);
+    else
+        res = mc_camsys_read(r->ptrs, r->n, r->dst, -1, r->info, &failed);
+    if (res != MC_OK)
+        snprintf(r->error, sizeof(r->error), "%s", failed >= 0 ? mc_cam_error(&r->cams[failed]) :
+                 r->n == 1 ? mc_cam_error(&r->cams[0]) : mc_strerror(res));
+    return res;
+}
+
+static double samples[MAX_SAMPLES];
+
+/* Decode throughput of one conversion path with `threads` cameras converting in parallel */
+static void
+bench_convert(const char *format, int width, int height, Variant variant, int threads, double seconds)
+{
+    uint8_t *sample;
+    Rig r;
+    int n = 0, res;
+    uint64_t start, t;
+
+    json_item();
+    fprintf(out, "\"format\": \"%s\", \"output\": \"RGB\", \"width\": %d, \"height\": %d, \"variant\": \"%s\", \"threads\": %d",
+            format, width, height, VARIANTS[variant], threads);
+    sim_sample_size = make_sample(format, width, height, &sample);
+    sim_sample = sample;
+    sim_fps = 0;
+    if (!sim_sample_size) {
+        fprintf(out, ", \"error\": \"Unsupported size for this format\"}");
+        return;
+    }
+    fprintf(out, ", \"sample_bytes\": %zu", sim_sample_size);
+    res = rig_init(&r, threads, format, width, height, 0, variant);
+    for (int i=0; i<2 && res == MC_OK; i++) res = rig_read(&r); //Warm up
+    start = now_us();
+    while (res == MC_OK && n < MAX_SAMPLES && (n < 5 || now_us() - start < seconds * 1e6)) {
+        t = now_us();
+        res = rig_read(&r);
+        samples[n++] = (double) (now_us() - t);
+    }
+    if (res != MC_OK) {
+        fprintf(out, ", \"error\": ");
+        json_string(r.error);
+    }
+    else {
+        double elapsed = (now_us() - start) * 1e-6;
+        fprintf(out, ", \"reads\": %d, \"seconds\": %.3f, \"fps\": %.1f, \"mpix_per_s\": %.1f",
+                n, elapsed, n * threads / elapsed, n * threads * (double) width * height / elapsed * 1e-6);
+        json_stats("read_us", samples, n);
+    }
+    fprintf(out, "}");
+    rig_destroy(&r);
+    free(sample);
+    fflush(out);
+}
+
+/* Throughput and latency (frame capture to return of camsys read) of `n` paced cameras */
+static void
+bench_camsys(const char *format, int width, int height, int n, float fps, double seconds)
+{
+    static double latency[MAX_SAMPLES], skew[MAX_SAMPLES];
+    uint8_t *sample;
+    Rig r;
+    int reads = 0, n_lat = 0, res;
+    uint64_t start, t, first_seq = 0, last_seq = 0;
+
+    json_item();
+    fprintf(out, "\"format\": \"%s\", \"output\": \"RGB\", \"width\": %d, \"height\": %d, \"cameras\": %d, \"camera_fps\": %g",
+            format, width, height, n, (double) fps);
+    sim_sample_size = make_sample(format, width, height, &sample);
+    sim_sample = sample;
+    sim_fps = fps;
+    if (!sim_sample_size) {
+        fprintf(out, ", \"error\": \"Unsupported size for this format\"}");
+        return;
+    }
+    res = rig_init(&r, n, format, width, height, fps, VARIANT_DIRECT);
+    if (res == MC_OK && (res = rig_read(&r)) == MC_OK) first_seq = r.info[0].sequence;
+    start = now_us();
+    while (res == MC_OK && n_lat + n <= MAX_SAMPLES && now_us() - start < seconds * 1e6) {
+        if ((res = rig_read(&r)) != MC_OK) break;
+        t = now_us();
+        uint64_t lo = r.info[0].timestamp_us, hi = lo;
+        for (int i=0; i<n; i++) {
+            latency[n_lat++] = (double) (t - r.info[i].timestamp_us);
+            if (r.info[i].timestamp_us < lo) lo = r.info[i].timestamp_us;
+            if (r.info[i].timestamp_us > hi) hi = r.info[i].timestamp_us;
+        }
+        skew[reads++] = (double) (hi - lo);
+        last_seq = r.info[0].sequence;
+    }
+    if (res != MC_OK) {
+        fprintf(out, ", \"error\": ");
+        json_string(r.error);
+    }
+    else {
+        double elapsed = (now_us() - start) * 1e-6;
+        //Frames the first camera captured but that were never read
+        long dropped = reads ? (long) (last_seq - first_seq) - reads : 0;
+        fprintf(out, ", \"reads\": %d, \"seconds\": %.3f, \"reads_per_s\": %.1f, \"frames_per_s\": %.1f, \"dropped\": %ld",
+                reads, elapsed, reads / elapsed, reads * n / elapsed, dropped);
+        json_stats("latency_us", latency, n_lat);
+        json_stats("skew_us", skew, reads);
+    }
+    fprintf(out, "}");
+    rig_destroy(&r);
+    free(sample);
+    fflush(out);
+}
+
+/*
+ * Command line
+ */
+static int
+parse_list(const char *s, char items[][16], int max)
+{
+    int n = 0;
+    while (*s && n < max) {
+        size_t len = strcspn(s, ",");
+        snprintf(items[n++], 16, "%.*s", (int) len, s);
+        s += len + (s[len] == ',');
+    }
+    return n;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -o, --output FILE      Write JSON to FILE (default: stdout)\n"
+            "  -f, --formats LIST     Capture formats (default: all, e.g. MJPG,YUYV,NV12,GREY)\n"
+            "  -s, --sizes LIST       Frame sizes (default: 320x240,640x480,1280x720,1920x1080)\n"
+            "  -t, --threads LIST     Parallel cameras for conversion (default: 1,2,4,... up to the CPU count)\n"
+            "  -d, --seconds S        Time per conversion benchmark (default: 0.3)\n"
+            "  -c, --cameras LIST     Cameras for the end-to-end benchmark (default: 1,2,4)\n"
+            "  -r, --fps FPS          Frame rate of simulated cameras end-to-end (default: 30)\n"
+            "  -e, --e2e-seconds S    Time per end-to-end benchmark (default: 2, 0 to skip)\n"
+            "  -q, --quick            Short run: 640x480 only, 0.1 s per benchmark\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"output", required_argument, NULL, 'o'}, {"formats", required_argument, NULL, 'f'},
+        {"sizes", required_argument, NULL, 's'}, {"threads", required_argument, NULL, 't'},
+        {"seconds", required_argument, NULL, 'd'}, {"cameras", required_argument, NULL, 'c'},
+        {"fps", required_argument, NULL, 'r'}, {"e2e-seconds", required_argument, NULL, 'e'},
+        {"quick", no_argument, NULL, 'q'}, {"help", no_argument, NULL, 'h'}, {NULL, 0, NULL, 0}
+    };
+    char formats[32][16], sizes[32][16], threads[32][16], cameras[32][16];
+    int n_formats = 0, n_sizes, n_threads = 0, n_cameras, opt;
+    double seconds = 0.3, e2e_seconds = 2;
+    float fps = 30;
+    const char *output = NULL;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    n_sizes = parse_list("320x240,640x480,1280x720,1920x1080", sizes, 32);
+    n_cameras = parse_list("1,2,4", cameras, 32);
+    while ((opt = getopt_long(argc, argv, "o:f:s:t:d:c:r:e:qh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'o': output = optarg; break;
+            case 'f': n_formats = parse_list(optarg, formats, 32); break;
+            case 's': n_sizes = parse_list(optarg, sizes, 32); break;
+            case 't': n_threads = parse_list(optarg, threads, 32); break;
+            case 'd': seconds = atof(optarg); break;
+            case 'c': n_cameras = parse_list(optarg, cameras, 32); break;
+            case 'r': fps = (float) atof(optarg); break;
+            case 'e': e2e_seconds = atof(optarg); break;
+            case 'q':
+                n_sizes = parse_list("640x480", sizes, 32);
+                seconds = 0.1;
+                e2e_seconds = 0.5;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (!n_formats)
+        for (size_t i=0; i<sizeof(FORMATS)/sizeof(FORMATS[0]); i++) snprintf(formats[n_formats++], 16, "%s", FORMATS[i]);
+    if (!n_threads)
+        for (long t=1; t<=ncpu && n_threads<32; t*=2) snprintf(threads[n_threads++], 16, "%ld", t);
+    if (fps <= 0) {
+        fprintf(stderr, "--fps must be positive\n");
+        return 2;
+    }
+    out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Cannot open '%s': %s\n", output, strerror(errno));
+        return 1;
+    }
+
+    fprintf(out, "{\n");
+    json_host();
+    fprintf(out, ",\n  \"convert\": [");
+    out_first = 1;
+    for (int f=0; f<n_formats; f++)
+    for (int s=0; s<n_sizes; s++)
+    for (int v=0; v<3; v++)
+    for (int t=0; t<n_threads; t++) {
+        int w, h;
+        if (sscanf(sizes[s], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0 || atoi(threads[t]) <= 0) continue;
+        if (output) fprintf(stderr, "convert %s %dx%d %s x%s\n", formats[f], w, h, VARIANTS[v], threads[t]);
+        bench_convert(formats[f], w, h, (Variant) v, atoi(threads[t]), seconds);
+    }
+    fprintf(out, "\n  ],\n  \"camsys\": [");
+    out_first = 1;
+    for (int f=0; f<n_formats && e2e_seconds > 0; f++) {
+        if (strcmp(formats[f], "MJPG") && strcmp(formats[f], "YUYV")) continue; //Typical UVC formats only
+        for (int s=0; s<n_sizes; s++)
+        for (int c=0; c<n_cameras; c++) {
+            int w, h;
+            if (sscanf(sizes[s], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0 || atoi(cameras[c]) <= 0) continue;
+            if (output) fprintf(stderr, "camsys %s %dx%d x%s\n", formats[f], w, h, cameras[c]);
+            bench_camsys(formats[f], w, h, atoi(cameras[c]), fps, e2e_seconds);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (output) fclose(out);
+    return 0;
+}
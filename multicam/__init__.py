@@ -1,3 +1,4 @@
-from .multicam import Multicam, Camera, list_cams
+from .multicam import Multicam, Camera, Mosaic, Remap, list_cams
 from .backend import is_valid_device, get_formats
-__all__ = ["Multicam", "Camera", "get_formats", "is_valid_device", "list_cams"]
+from .autoformat import plan_formats
+__all__ = ["Multicam", "Camera", "Mosaic", "Remap", "get_formats", "is_valid_device", "plan_formats", "list_cams"]
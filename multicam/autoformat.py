@@ -0,0 +1,152 @@
+from .backend import get_formats
+from pathlib import Path
+import warnings
+
+__all__ = ["plan_formats", "usb_topology", "estimate_bandwidth"]
+
+# Bytes per pixel on the wire. MJPG is an estimate of typical webcam compression.
+BYTES_PER_PIXEL = {
+    "YUYV": 2.0, "UYVY": 2.0, "YU16": 2.0,
+    "NV12": 1.5, "NV21": 1.5, "YU12": 1.5, "YV12": 1.5,
+    "RGB3": 3.0, "BGR3": 3.0,
+    "MJPG": 0.3,
+}
+
+# Relative CPU cost per pixel of converting each format to RGB
+DECODE_COST = {
+    "RGB3": 0.6, "BGR3": 0.6,
+    "YUYV": 1.0, "UYVY": 1.0, "YU16": 1.0,
+    "NV12": 1.0, "NV21": 1.0, "YU12": 1.0, "YV12": 1.0,
+    "MJPG": 6.0,
+}
+
+# Isochronous bandwidth (bytes/s) per device endpoint and usable fraction of the bus, by speed in Mbps
+USB_ENDPOINT_LIMIT = {1.5: 0.0, 12: 1023 * 1000, 480: 3 * 1024 * 8000, 5000: 3 * 16 * 1024 * 8000}
+USB_PERIODIC_FRACTION = {1.5: 0.9, 12: 0.9, 480: 0.8}
+USB_PERIODIC_FRACTION_SS = 0.9
+
+# Protocol overhead (UVC payload headers, partly filled packets)
+USB_OVERHEAD = 1.1
+
+def _devpath(dev):
+    return Path(f"/dev/video{dev}") if isinstance(dev, int) else Path(dev)
+
+def usb_topology(dev):
+    '''
+      Find the USB bus of a video device using sysfs.
+      Returns a dict with `bus` (bus number), `speed` (Mbps), `endpoint_limit`
+      and `bus_budget` (bytes/s), or `None` if the device is not on USB.
+    '''
+    name = _devpath(dev).resolve().name
+    node = Path(f"/sys/class/video4linux/{name}/device")
+    if not node.exists(): return None
+    node = node.resolve()
+    while node != node.parent: #The USB device is the first ancestor with a bus number
+        if (node / "busnum").exists() and (node / "speed").exists():
+            break
+        node = node.parent
+    else:
+        return None
+    try:
+        bus = int((node / "busnum").read_text())
+        speed = float((node / "speed").read_text())
+    except (OSError, ValueError):
+        return None
+    fraction = USB_PERIODIC_FRACTION.get(speed, USB_PERIODIC_FRACTION_SS)
+    limit = USB_ENDPOINT_LIMIT.get(speed, USB_ENDPOINT_LIMIT[5000] * speed / 5000)
+    return {"bus": bus, "speed": speed, "endpoint_limit": limit, "bus_budget": fraction * speed * 1e6 / 8}
+
+def estimate_bandwidth(format, size, fps):
+    '''Estimated USB bandwidth in bytes/s of streaming `format` at `size` and `fps`.'''
+    return BYTES_PER_PIXEL[format] * size[0] * size[1] * fps * USB_OVERHEAD
+
+def _candidates(dev, size, fps, formats):
+    '''(format, fps, rate) modes of `dev` at `size` delivering at least `fps`, cheapest decode first.'''
+    res = []
+    for fmt, details in get_formats(_devpath(dev)).items():
+        if fmt not in DECODE_COST or (formats is not None and fmt not in formats): continue
+        rates = details["framesizes"].get(tuple(size), [])
+        rates = sorted(float(r) for r in rates if float(r) >= fps - 1e-3)
+        if not rates: continue
+        capture_fps = rates[0] #Lowest rate that is fast enough; decimate if not exact
+        rate = (fps if abs(capture_fps - fps) > 1e-3 else None)
+        res.append({
+            "format": fmt,
+            "fps": capture_fps,
+            "rate": rate,
+            "bandwidth": estimate_bandwidth(fmt, size, capture_fps),
+            "decode_cost": DECODE_COST[fmt] * size[0] * size[1] * fps,
+        })
+    return sorted(res, key=lambda c: (c["decode_cost"], c["bandwidth"]))
+
+def plan_formats(devs, size=(640,480), fps=30, formats=None):
+    '''
+      Choose a format per camera for streaming at `size` and `fps`.
+
+      Each camera gets the mode that is cheapest to decode, unless the cameras
+      sharing a USB bus would then exceed its isochronous bandwidth. In that case
+      cameras are moved to less bandwidth hungry (e.g. compressed) modes, those
+      costing the least extra decode CPU per saved byte first.
+
+      Parameters
+      ----------
+       devs : list of device paths or integers
+       size : tuple (width, height)
+       fps : Output rate. Cameras may capture faster and be decimated.
+       formats : Iterable of allowed FOURCCs, or None for all supported.
+
+      Returns
+      -------
+       dict with
+         "cameras" : list with a dict per camera; "dev", "format", "fps", "rate",
+                     "bus", "bandwidth" (bytes/s) and "decode_cost" (relative)
+         "buses" : {bus: {"budget": bytes/s, "used": bytes/s, "cameras": [indices]}}
+         "fits" : bool; whether all buses are within budget
+    '''
+    cands, topo = [], []
+    for dev in devs:
+        c = _candidates(dev, size, fps, formats)
+        if not c: raise ValueError(f"'{dev}' supports no usable format at size {tuple(size)} and {fps} fps.")
+        cands.append(c)
+        topo.append(usb_topology(dev))
+
+    choice = [0] * len(devs)
+    # A single camera must fit its own endpoint
+    for i, t in enumerate(topo):
+        if t is None: continue
+        fitting = [j for j, c in enumerate(cands[i]) if c["bandwidth"] <= t["endpoint_limit"]]
+        if fitting: choice[i] = fitting[0]
+        else: choice[i] = min(range(len(cands[i])), key=lambda j: cands[i][j]["bandwidth"])
+
+    buses = {}
+    for i, t in enumerate(topo):
+        if t is None: continue
+        b = buses.setdefault(t["bus"], {"budget": t["bus_budget"], "used": 0.0, "cameras": []})
+        b["cameras"].append(i)
+
+    fits = True
+    for b in buses.values():
+        used = lambda: sum(cands[i][choice[i]]["bandwidth"] for i in b["cameras"])
+        while used() > b["budget"]:
+            best = None
+            for i in b["cameras"]:
+                cur = cands[i][choice[i]]
+                for j, c in enumerate(cands[i]):
+                    saved = cur["bandwidth"] - c["bandwidth"]
+                    if saved <= 0: continue
+                    cost = (c["decode_cost"] - cur["decode_cost"]) / saved
+                    if best is None or cost < best[0]: best = (cost, i, j)
+            if best is None: break
+            choice[best[1]] = best[2]
+        b["used"] = used()
+        if b["used"] > b["budget"]: fits = False
+
+    if not fits:
+        warnings.warn("Cameras exceed the estimated USB bandwidth; streaming may fail.")
+    cameras = []
+    for i, dev in enumerate(devs):
+        c = dict(cands[i][choice[i]])
+        c["dev"] = dev
+        c["bus"] = (topo[i]["bus"] if topo[i] else None)
+        cameras.append(c)
+    return {"cameras": cameras, "buses": buses, "fits": fits}
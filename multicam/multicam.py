@@ -1,8 +1,50 @@
-from .backend import v4l2cam, camsys_read, is_valid_device, get_formats
+from .backend import v4l2cam, mosaic, remap, camsys_read, camsys_next, camsys_read_mosaic, is_valid_device, get_formats
+from .autoformat import plan_formats
 from pathlib import Path
 import numpy as np
 
-__all__ = ["Multicam", "Camera", "list_cams"]
+__all__ = ["Multicam", "Camera", "Mosaic", "Remap", "list_cams"]
+
+class Remap():
+    '''
+      Precomputed lens undistortion/rectification for one camera,
+      applied natively while converting frames.
+      
+      Parameters
+      ----------
+       size : tuple (width, height)
+         Size of the camera, and of the undistorted output.
+       mapx, mapy : arrays (height, width)
+         Source coordinates for every output pixel,
+         e.g. from `cv2.initUndistortRectifyMap(..., cv2.CV_32FC1)`.
+       K, D, R, P :
+         Alternatively; camera matrix, distortion coefficients (k1, k2, p1, p2[, k3]),
+         rectification and new camera matrix (R and P are optional).
+      
+      Methods
+      -------
+       load(path, size=None) : Load from an .npz file with either `mapx` and `mapy`
+         or `K`, `D` and optionally `R` and `P` (the 3x3 part of a 3x4 projection).
+      
+      Examples
+      --------
+      r = Remap((640,480), K=K, D=D, R=R1, P=P1[:,:3])
+      with Camera("/dev/video0", remap=r) as c:
+          data = c.read() #Rectified
+    '''
+    def __init__(self, size, mapx=None, mapy=None, K=None, D=None, R=None, P=None):
+        self.size = tuple(size)
+        if P is not None: P = np.asarray(P, np.float64)[:3,:3]
+        self._remap = remap(self.size, mapx, mapy, K, D, R, P)
+    
+    @classmethod
+    def load(cls, path, size=None):
+        with np.load(path) as d:
+            kw = {k: d[k] for k in ("mapx", "mapy", "K", "D", "R", "P") if k in d}
+            if size is None and "size" in d: size = tuple(int(v) for v in d["size"])
+        if size is None and "mapx" in kw: size = kw["mapx"].shape[::-1]
+        if size is None: raise ValueError(f"No size given or found in '{path}'.")
+        return cls(size, **kw)
 
 class Camera():
     '''
@@ -14,12 +56,19 @@ class Camera():
          Video capture device path or integer, specifing /dev/video<N> device.
        size : tuple (width, height)
        format : str
-         FOURCC string (e.g. "MJPG" or YUYV")
+         FOURCC string (e.g. "MJPG" or YUYV"), or "auto" to pick the mode
+         cheapest to decode that fits the USB bus (see `plan_formats`).
        fps : int
+       rate : float or None
+         Target output rate in frames per second. Frames above this rate are
+         dropped before decoding. `None` outputs every frame.
+       remap : Remap or None
+         Undistortion/rectification applied while converting.
       
       Attributes
       ----------
        started : Bool; Is camera started?
+       plan : dict or None; Chosen mode when format is "auto"
       
       Methods
       -------
@@ -28,6 +77,13 @@ class Camera():
        read(n=None) :
          if `n` is not `None`; read `n` frames.
        get_formats() : Get available formats, resolutions and framerates
+       serve(port=8080, address="127.0.0.1", slots=None) :
+         Serve the camera's MJPEG frames, undecoded, as an HTTP multipart
+         stream to any number of clients (format must be "MJPG"). `address`
+         may also be a Unix socket path. Returns the port (useful with
+         port=0). The camera cannot be read while serving.
+       stop_serving() : Stop the stream server
+       stream_info() : dict with port, clients, frames, dropped and sent, or None
          
       Examples
       --------
@@ -41,11 +97,17 @@ class Camera():
       with Camera("/dev/video0", "/dev/video2") as c:
           data = c.read()
     '''
-    def __init__(self, dev, size=(640,480), format="MJPG", fps=30):
+    def __init__(self, dev, size=(640,480), format="MJPG", fps=30, rate=None, remap=None,
+                 cpus=None, rt_priority=None):
         self.dev = dev
         self.size = size
         self.format = format
         self.fps = fps
+        self.rate = rate
+        self.remap = remap
+        self.cpus = cpus
+        self.rt_priority = rt_priority
+        self.plan = None
         self._v4l2cam = None
     
     @property
@@ -71,7 +133,14 @@ class Camera():
         self.stop() #Restart if already started
         try:
             d = self._devpath()
-            self._v4l2cam = v4l2cam(d, self.size, self.format, self.fps)
+            format, fps, rate = self.format, self.fps, self.rate
+            if format.lower() == "auto":
+                self.plan = plan_formats([d], self.size, self.fps)
+                format, fps, rate = _planned_mode(self.plan["cameras"][0], rate)
+            self._v4l2cam = v4l2cam(d, self.size, format, fps, rate or 0)
+            if self.remap is not None: self._v4l2cam.set_remap(self.remap._remap)
+            if self.cpus is not None: self._v4l2cam.set_affinity(list(self.cpus))
+            if self.rt_priority: self._v4l2cam.set_realtime(self.rt_priority)
             self._v4l2cam.start()
         except Exception as e:
             self.stop()
@@ -80,6 +149,17 @@ class Camera():
     def stop(self):
         if self.started: self._v4l2cam.stop()
     
+    def serve(self, port=8080, address="127.0.0.1", slots=None):
+        if not self.started:
+            raise RuntimeError("Camera has not been started")
+        return self._v4l2cam.serve(address, port, slots or 0)
+    
+    def stop_serving(self):
+        if self._v4l2cam is not None: self._v4l2cam.serve_stop()
+    
+    def stream_info(self):
+        return (self._v4l2cam.serve_info() if self._v4l2cam is not None else None)
+    
     def read(self, n=None):
         if not self.started:
             raise RuntimeError("Camera has not been started")
@@ -96,6 +176,99 @@ class Camera():
         
     def __del__(self): self.stop()
 
+class Mosaic():
+    '''
+      Layout for composing the frames of a Multicam into a single image.
+      Each camera is converted (and scaled) directly into its tile.
+      
+      Parameters
+      ----------
+       grid : tuple (rows, cols) or None
+         Number of tile rows and columns. `None` puts all cameras on one row.
+       scale : float
+         Tile size relative to the camera size.
+       border : int
+         Border width in pixels around and between tiles.
+       border_color : tuple (r, g, b)
+       overlay : array (H, W, 3) or None
+         Drawn on top of the mosaic wherever `mask` is nonzero (e.g. labels).
+         Use `shape()` and `tiles()` to find where to draw; (H, W) must be
+         the mosaic shape.
+       mask : array (H, W) or None
+         Defaults to the nonzero pixels of `overlay`.
+      
+      Methods
+      -------
+       shape(n, size) : Mosaic (height, width) for `n` cameras of size (width, height)
+       tiles(n, size) : Tile placements [(x, y, width, height), ...]
+      
+      Examples
+      --------
+      with Multicam(["/dev/video0", "/dev/video2"], layout=Mosaic((1,2), scale=0.5, border=4)) as mc:
+          data = mc.read() #(H, W, 3)
+    '''
+    def __init__(self, grid=None, scale=1.0, border=0, border_color=(0,0,0), overlay=None, mask=None):
+        self.grid = grid
+        self.scale = scale
+        self.border = border
+        self.border_color = border_color
+        if overlay is None and mask is not None:
+            raise ValueError("A mask needs an overlay.")
+        if overlay is not None:
+            overlay = np.asarray(overlay)
+            if overlay.ndim != 3 or overlay.shape[2] != 3:
+                raise ValueError(f"overlay must have shape (H, W, 3), got {overlay.shape}.")
+            mask = (overlay.any(axis=2) if mask is None else np.asarray(mask))
+            if mask.shape != overlay.shape[:2]:
+                raise ValueError(f"mask must have shape {overlay.shape[:2]} like the overlay, got {mask.shape}.")
+        self.overlay = overlay
+        self.mask = mask
+    
+    def _grid(self, n):
+        rows, cols = (self.grid if self.grid is not None else (1, n))
+        if rows * cols < n: raise ValueError(f"Grid {rows}x{cols} has room for less than {n} cameras.")
+        return rows, cols
+    
+    def _tile_size(self, size):
+        return max(1, round(size[0] * self.scale)), max(1, round(size[1] * self.scale))
+    
+    def shape(self, n, size):
+        rows, cols = self._grid(n)
+        w, h = self._tile_size(size)
+        b = self.border
+        return rows * (h + b) + b, cols * (w + b) + b
+    
+    def tiles(self, n, size):
+        rows, cols = self._grid(n)
+        w, h = self._tile_size(size)
+        b = self.border
+        return [(b + (i % cols) * (w + b), b + (i // cols) * (h + b), w, h) for i in range(n)]
+    
+    def _build(self, n, size):
+        H, W = self.shape(n, size)
+        tiles = self.tiles(n, size)
+        if self.overlay is not None and self.overlay.shape[:2] != (H, W):
+            raise ValueError(f"overlay has shape {self.overlay.shape[:2]}, but the mosaic of {n} cameras "
+                             f"of size {tuple(size)} has shape ({H}, {W}).")
+        overlay, mask = None, None
+        if self.border > 0 or self.mask is not None:
+            overlay = np.zeros((H, W, 3), np.uint8)
+            mask = np.zeros((H, W), np.uint8)
+            if self.border > 0:
+                mask[:] = 1
+                for x, y, w, h in tiles: mask[y:y+h, x:x+w] = 0
+                overlay[mask != 0] = self.border_color
+            if self.mask is not None:
+                m = self.mask != 0
+                overlay[m] = self.overlay[m]
+                mask[m] = 1
+        return mosaic((W, H), tiles, overlay, mask)
+
+def _planned_mode(cam_plan, rate):
+    '''(format, fps, rate) for a camera from its plan, honouring a requested rate.'''
+    rates = [r for r in (rate, cam_plan["rate"]) if r]
+    return cam_plan["format"], cam_plan["fps"], (min(rates) if rates else None)
+
 class Multicam():
     '''
       Set up a system of cameras for synchronized reading.
@@ -107,21 +280,50 @@ class Multicam():
          Video capture device paths or integers, specifing /dev/video<N> devices.
        size : tuple (width, height)
        format : str
-         FOURCC string (e.g. "MJPG" or YUYV")
+         FOURCC string (e.g. "MJPG" or YUYV"), or "auto" to choose a format per
+         camera that is cheapest to decode while fitting the bandwidth of the
+         USB buses (see `plan_formats`). The chosen plan is in `plan`.
        fps : int
+       rates : float, list or None
+         Target output rate per camera in frames per second (a single value
+         applies to all cameras). Frames above the rate are dropped before
+         decoding. `None` outputs every frame.
+       layout : Mosaic or None
+         If given, `read()` composes all cameras into one (H, W, 3) mosaic.
+       remaps : list or None
+         Remap (or None) per camera, e.g. for stereo rectification.
+       cpus : list or None
+         CPU list (or None) per camera, e.g. the CPUs of the NUMA node closest
+         to each camera's USB controller. Frames of `read()` are then placed on
+         the node of their camera.
+       rt_priority : int or None
+         SCHED_FIFO priority of all capture threads (see `Camera`).
       
       Attributes
       ----------
        started : Bool; Are cameras started?
+       plan : dict or None; Chosen modes and bus usage when format is "auto"
       
       Methods
       -------
        start() : Start cameras
        stop() : Stop cameras
-       read(n=None, ids=None) :
+       read(n=None, ids=None, out=None, timestamps=False) :
          if `n` is not `None`; read `n` frames.
          If `ids` is `None`; read from all cameras.
          Else, `ids` should be an iterable containing the camera indices to read from.
+         With a `layout`, `out` may be a preallocated (H, W, 3) uint8 mosaic to write into.
+         Each camera delivers its newest frame, so a group is as recent as its
+         slowest camera. With `timestamps`, returns `(frames, timestamps)`,
+         the capture time of each frame in seconds (as `time.monotonic()`),
+         e.g. to check the skew of a group.
+       events(timeout=None, ids=None) :
+         Generator of `(camera_id, frame)` from all cameras, in timestamp order,
+         each camera at its own rate. `timeout` is in seconds; a `TimeoutError`
+         is raised if no camera delivers a frame in time.
+       serve(port=8080, address="127.0.0.1") :
+         Serve each camera as an MJPEG stream (see `Camera.serve`), camera i
+         on `port + i` (any free port if `port` is 0). Returns the ports.
          
       Examples
       --------
@@ -134,13 +336,26 @@ class Multicam():
       #Using a context manager:
       with Multicam(["/dev/video0", "/dev/video2"]) as mc:
           data = mc.read()
+      
+      #Multi-rate event stream
+      with Multicam(["/dev/video0", "/dev/video2"], fps=60, rates=[60, 5]) as mc:
+          for cam_id, frame in mc.events():
+              ...
     '''
-    def __init__(self, devs, size=(640,480), format="MJPG", fps=30):
+    def __init__(self, devs, size=(640,480), format="MJPG", fps=30, rates=None, layout=None, remaps=None,
+                 cpus=None, rt_priority=None):
         self.devs = devs
         self.size = size
         self.format = format
         self.fps = fps
+        self.rates = rates
+        self.layout = layout
+        self.remaps = remaps
+        self.cpus = cpus
+        self.rt_priority = rt_priority
+        self.plan = None
         self.cameras = []
+        self._mosaic = None
     
     @property
     def width(self): return self.size[0]
@@ -151,10 +366,35 @@ class Multicam():
     def started(self):
         return all([c.started for c in self.cameras])
        
+    def _rates(self):
+        if self.rates is None or np.isscalar(self.rates):
+            return [self.rates] * len(self.devs)
+        if len(self.rates) != len(self.devs):
+            raise ValueError(f"Got {len(self.rates)} rates for {len(self.devs)} cameras.")
+        return list(self.rates)
+    
+    def _remaps(self):
+        if self.remaps is None: return [None] * len(self.devs)
+        if len(self.remaps) != len(self.devs):
+            raise ValueError(f"Got {len(self.remaps)} remaps for {len(self.devs)} cameras.")
+        return list(self.remaps)
+    
+    def _cpus(self):
+        if self.cpus is None: return [None] * len(self.devs)
+        if len(self.cpus) != len(self.devs):
+            raise ValueError(f"Got {len(self.cpus)} CPU lists for {len(self.devs)} cameras.")
+        return list(self.cpus)
+       
     def start(self):
         try:
-            for dev in self.devs:
-                cam = Camera(dev, self.size, self.format, self.fps)
+            if self.layout is not None:
+                self._mosaic = self.layout._build(len(self.devs), self.size)
+            modes = [(self.format, self.fps, rate) for rate in self._rates()]
+            if self.format.lower() == "auto":
+                self.plan = plan_formats(self.devs, self.size, self.fps)
+                modes = [_planned_mode(p, rate) for p, (_, _, rate) in zip(self.plan["cameras"], modes)]
+            for dev, (format, fps, rate), rmap, cpus in zip(self.devs, modes, self._remaps(), self._cpus()):
+                cam = Camera(dev, self.size, format, fps, rate, rmap, cpus, self.rt_priority)
                 cam.start()
                 self.cameras.append(cam)
         except Exception as e:
@@ -167,16 +407,46 @@ class Multicam():
         finally:
             self.cameras = []     
     
-    def read(self, n=None, ids=None):
+    def read(self, n=None, ids=None, out=None, timestamps=False):
         if self.started:
             cams = ([self.cameras[i] for i in ids] if ids else self.cameras)
+            if self._mosaic is not None:
+                tiles = (list(ids) if ids else None)
+                if n is not None:
+                    reads = [camsys_read_mosaic(self, cams, self._mosaic, tiles, timestamps=timestamps) for _ in range(n)]
+                    if timestamps:
+                        return np.stack([r[0] for r in reads]), np.stack([r[1] for r in reads])
+                    return np.stack(reads)
+                return camsys_read_mosaic(self, cams, self._mosaic, tiles, out, timestamps)
             if n is not None:
-                return np.stack([camsys_read(self, cams) for _ in range(n)], axis=1)
+                reads = [camsys_read(self, cams, timestamps) for _ in range(n)]
+                if timestamps:
+                    return np.stack([r[0] for r in reads], axis=1), np.stack([r[1] for r in reads], axis=1)
+                return np.stack(reads, axis=1)
             else:
-                return camsys_read(self, cams)
+                return camsys_read(self, cams, timestamps)
         else:
             raise RuntimeError("One or more cameras not started.")
     
+    def serve(self, port=8080, address="127.0.0.1"):
+        if not self.started:
+            raise RuntimeError("One or more cameras not started.")
+        try:
+            return [cam.serve(port + i if port else 0, address) for i, cam in enumerate(self.cameras)]
+        except Exception as e:
+            for cam in self.cameras: cam.stop_serving()
+            raise e
+    
+    def events(self, timeout=None, ids=None):
+        if not self.started:
+            raise RuntimeError("One or more cameras not started.")
+        ids = (list(ids) if ids else list(range(len(self.cameras))))
+        cams = [self.cameras[i] for i in ids]
+        timeout_ms = (-1 if timeout is None else int(timeout * 1000))
+        while True:
+            i, frame = camsys_next(self, cams, timeout_ms)
+            yield ids[i], frame
+    
     def __enter__(self):
         self.start()
         return self
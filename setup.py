@@ -9,10 +9,10 @@ with open("README.md", "r") as fh:
 backend = Extension('multicam.backend',
     define_macros = [('HAVE_JPEG',), ('NPY_NO_DEPRECATED_API','NPY_1_7_API_VERSION')],
     include_dirs  = ['libyuv/include'],
-    libraries     = [':libyuv.a', ':libjpeg.so.8', 'stdc++'],
+    libraries     = [':libyuv.a', ':libjpeg.so.8', 'stdc++', 'm'],
     library_dirs  = ['libyuv/out'],
-    sources       = ['src/multicam.c', 'src/v4l2.c'],
-    extra_compile_args = [],
+    sources       = ['src/multicam.c', 'src/libmulticam.c', 'src/mosaic.c', 'src/numa.c', 'src/remap.c', 'src/stream.c', 'src/v4l2.c'],
+    extra_compile_args = ['-fvisibility=hidden'],
     extra_link_args    = [],
 )
 
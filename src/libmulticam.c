@@ -0,0 +1,1074 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include "libyuv.h"
+#include "libmulticam.h"
+#include "v4l2.h"
+#include "mosaic.h"
+#include "remap.h"
+#include "numa.h"
+#include "stream.h"
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+#define STR2FOURCC(s) FOURCC(toupper(s[0]),toupper(s[1]),toupper(s[2]),toupper(s[3]))
+#define STREAM_SLOTS 8
+
+/*
+ * Lifecycle
+ */
+int
+mc_cam_init(mc_camera *cam, const char *device)
+{
+    memset(cam, 0, sizeof(*cam));
+    cam->fd = -1;
+    cam->pending = -1;
+    cam->numa_node = -1;
+    if (!device) {
+        mc_seterr(cam, MC_ERR_ARG, "No device given");
+        return MC_ERR_ARG;
+    }
+    cam->device = strdup(device);
+    if (!cam->device) {
+        mc_seterr(cam, MC_ERR_MEMORY, "Out of memory");
+        return MC_ERR_MEMORY;
+    }
+    return MC_OK;
+}
+
+int
+mc_cam_configure(mc_camera *cam, int width, int height, const char *format, float fps)
+{
+    if (cam->fd != -1) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: Cannot configure an open camera", cam->device);
+        return MC_ERR_STATE;
+    }
+    if (width <= 0 || height <= 0) {
+        mc_seterr(cam, MC_ERR_ARG, "Invalid size (%d,%d)", width, height);
+        return MC_ERR_ARG;
+    }
+    if (format) {
+        if (strlen(format) != 4) {
+            mc_seterr(cam, MC_ERR_ARG, "`%s` is not a valid FOURCC", format);
+            return MC_ERR_ARG;
+        }
+        cam->fourcc = STR2FOURCC(format);
+    }
+    else
+        cam->fourcc = 0;
+    cam->width = width;
+    cam->height = height;
+    cam->fps = fps;
+    return MC_OK;
+}
+
+int
+mc_cam_open(mc_camera *cam)
+{
+    if (cam->fd != -1) return MC_OK;
+    if (!v4l2_open_device(cam)) {
+        v4l2_close_device(cam);
+        return cam->err;
+    }
+    if (!v4l2_init_device(cam)) {
+        int err = cam->err;
+        if (cam->buffers) v4l2_uninit_device(cam);
+        v4l2_close_device(cam);
+        cam->err = err;
+        return err;
+    }
+    return MC_OK;
+}
+
+int
+mc_cam_start(mc_camera *cam)
+{
+    int res;
+
+    if (cam->streaming) return MC_OK;
+    if ((res = mc_cam_open(cam)) != MC_OK) return res;
+    if (!v4l2_start_capturing(cam)) {
+        int err = cam->err;
+        v4l2_uninit_device(cam);
+        v4l2_close_device(cam);
+        cam->err = err;
+        return err;
+    }
+    cam->streaming = 1;
+    cam->pending = -1;
+    cam->next_due_us = 0;
+    return MC_OK;
+}
+
+int
+mc_cam_stop(mc_camera *cam)
+{
+    mc_cam_serve_stop(cam);
+    if (cam->fd == -1) return MC_OK;
+    if (cam->streaming) {
+        if (!v4l2_stop_capturing(cam)) return cam->err;
+        cam->streaming = 0;
+        cam->pending = -1; //STREAMOFF returns all buffers
+    }
+    if (!v4l2_uninit_device(cam)) return cam->err;
+    if (!v4l2_close_device(cam)) return cam->err;
+    return MC_OK;
+}
+
+void
+mc_cam_destroy(mc_camera *cam)
+{
+    mc_cam_stop(cam);
+    free(cam->device);
+    free(cam->cpus);
+    mcnuma_free(cam->scratch, cam->scratch_size);
+    cam->device = NULL;
+    cam->cpus = NULL;
+    cam->n_cpus = 0;
+    cam->scratch = NULL;
+    cam->scratch_size = 0;
+}
+
+/*
+ * Reading
+ */
+size_t
+mc_cam_frame_size(const mc_camera *cam)
+{
+    return (size_t) cam->width * cam->height * 3;
+}
+
+int
+mc_cam_set_rate(mc_camera *cam, float rate)
+{
+    if (rate < 0) {
+        mc_seterr(cam, MC_ERR_ARG, "Invalid rate %g", (double) rate);
+        return MC_ERR_ARG;
+    }
+    cam->rate = rate;
+    cam->next_due_us = 0;
+    return MC_OK;
+}
+
+/* Where a decoded frame goes: packed RGB with `stride` bytes per row */
+typedef struct CamOutput {
+    uint8_t *dst;
+    int stride;
+    int width;
+    int height;
+} CamOutput;
+
+/* Full size output into a packed buffer */
+static CamOutput
+cam_output(const mc_camera *cam, uint8_t *dst)
+{
+    return (CamOutput){dst, cam->width*3, cam->width, cam->height};
+}
+
+int
+mc_cam_set_remap(mc_camera *cam, const mc_remap *remap)
+{
+    if (remap && (remap->src_width != cam->width || remap->src_height != cam->height ||
+                  remap->width != cam->width || remap->height != cam->height)) {
+        mc_seterr(cam, MC_ERR_ARG, "%s: Remap size does not match camera size (%d,%d)", cam->device, cam->width, cam->height);
+        return MC_ERR_ARG;
+    }
+    cam->remap = remap;
+    return MC_OK;
+}
+
+int
+mc_cam_set_affinity(mc_camera *cam, const int *cpus, int n)
+{
+    int *copy = NULL;
+    cpu_set_t allowed;
+
+    if (!cpus || n <= 0) //Any CPU
+        n = 0;
+    if (n > 0 && sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: sched_getaffinity failure : %d, %s", cam->device, errno, strerror(errno));
+        return MC_ERR_STATE;
+    }
+    for (int i=0; i<n; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            mc_seterr(cam, MC_ERR_ARG, "%s: Invalid CPU %d", cam->device, cpus[i]);
+            return MC_ERR_ARG;
+        }
+        if (!CPU_ISSET(cpus[i], &allowed)) { //Offline, or excluded by cpuset/taskset
+            mc_seterr(cam, MC_ERR_ARG, "%s: CPU %d is not available to this process", cam->device, cpus[i]);
+            return MC_ERR_ARG;
+        }
+    }
+    if (n > 0) {
+        copy = malloc(n * sizeof(int));
+        if (!copy) {
+            mc_seterr(cam, MC_ERR_MEMORY, "Out of memory");
+            return MC_ERR_MEMORY;
+        }
+        memcpy(copy, cpus, n * sizeof(int));
+    }
+    free(cam->cpus);
+    cam->cpus = copy;
+    cam->n_cpus = n;
+    cam->numa_node = mcnuma_node_of_cpus(copy, n);
+    //Move scratch memory to the new node on next use
+    mcnuma_free(cam->scratch, cam->scratch_size);
+    cam->scratch = NULL;
+    cam->scratch_size = 0;
+    return MC_OK;
+}
+
+static void *
+noop_worker(void *arg)
+{
+    (void) arg;
+    return NULL;
+}
+
+static int cam_thread_create(mc_camera *cam, pthread_t *thread, void *(*fn)(void *), void *arg, int fallback);
+static int cam_thread_error(mc_camera *cam, int r);
+
+int
+mc_cam_set_realtime(mc_camera *cam, int priority)
+{
+    pthread_t thread;
+    int r, previous;
+
+    if (priority < 0 || (priority > 0 && (priority < sched_get_priority_min(SCHED_FIFO) ||
+                                          priority > sched_get_priority_max(SCHED_FIFO)))) {
+        mc_seterr(cam, MC_ERR_ARG, "%s: Invalid SCHED_FIFO priority %d", cam->device, priority);
+        return MC_ERR_ARG;
+    }
+    previous = cam->rt_priority;
+    cam->rt_priority = priority;
+    if (!priority) return MC_OK;
+
+    //Check that real-time threads are permitted
+    r = cam_thread_create(cam, &thread, noop_worker, NULL, 0);
+    if (r == 0) {
+        pthread_join(thread, NULL);
+        return MC_OK;
+    }
+    if (r != EPERM) {
+        cam->rt_priority = previous;
+        return cam_thread_error(cam, r);
+    }
+    cam->rt_priority = 0;
+    mc_seterr(cam, MC_ERR_PERM, "%s: SCHED_FIFO priority %d not permitted (%s); using normal scheduling",
+              cam->device, priority, strerror(r));
+    return MC_ERR_PERM;
+}
+
+/*
+ * Start a thread with the camera's CPU affinity and scheduling policy. With
+ * `fallback`, a thread without real-time scheduling is started if that is
+ * not permitted. Returns 0 or an errno value, as pthread_create().
+ */
+static int
+cam_thread_create(mc_camera *cam, pthread_t *thread, void *(*fn)(void *), void *arg, int fallback)
+{
+    pthread_attr_t attr;
+    cpu_set_t set;
+    struct sched_param param = {.sched_priority = cam->rt_priority};
+    int r;
+
+    if (!cam->n_cpus && !cam->rt_priority) return pthread_create(thread, NULL, fn, arg);
+    pthread_attr_init(&attr);
+    if (cam->n_cpus) {
+        CPU_ZERO(&set);
+        for (int i=0; i<cam->n_cpus; i++) CPU_SET(cam->cpus[i], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    if (cam->rt_priority) {
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    r = pthread_create(thread, &attr, fn, arg);
+    if (r == EPERM && cam->rt_priority && fallback) {
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        r = pthread_create(thread, &attr, fn, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return r;
+}
+
+/* Report that cam_thread_create() failed with `r` */
+static int
+cam_thread_error(mc_camera *cam, int r)
+{
+    int err = (r == EINVAL) ? MC_ERR_ARG : MC_ERR_STATE; //EINVAL: CPU affinity or priority not usable
+    mc_seterr(cam, err, "%s: Cannot start capture thread : %d, %s", cam->device, r, strerror(r));
+    return err;
+}
+
+/* Meeting point of the read workers of a camera system, once each has grabbed a frame */
+typedef struct CamsysSync {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int grabbing;           /* Workers still grabbing */
+    int failed;             /* A worker failed or did not start */
+    uint64_t ref_us;        /* Timestamp of the newest grabbed frame */
+} CamsysSync;
+
+typedef struct CamReadWorkerArgStruct {
+    mc_camera *cam;
+    CamOutput out;
+    int timeout_ms;
+    mc_frame_info *info;
+    const mc_mosaic *mosaic;
+    int tile;
+    int res;
+    CamsysSync *sync;       /* Set by camsys_run() */
+} CamReadWorkerArgStruct;
+
+static uint64_t
+now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Milliseconds left until `deadline` (rounded up), or -1 if there is no deadline */
+static int
+ms_left(uint64_t deadline)
+{
+    uint64_t now;
+    if (!deadline) return -1;
+    now = now_us();
+    return (now >= deadline) ? 0 : (int) ((deadline - now + 999) / 1000);
+}
+
+/* Wait until a buffer can be dequeued. Returns 1 if ready, 0 on timeout and -1 on error. */
+static int
+cam_wait_frame(mc_camera *cam, int timeout_ms)
+{
+    struct pollfd pfd = {cam->fd, POLLIN, 0};
+    int r;
+
+    do {
+        r = poll(&pfd, 1, timeout_ms);
+    }
+    while (r == -1 && errno == EINTR);
+
+    if (r == -1) {
+        mc_seterr(cam, MC_ERR_DQBUF, "%s: poll failure : %d, %s", cam->device, errno, strerror(errno));
+        return -1;
+    }
+    return r > 0;
+}
+
+/* Check that the camera can be read: started, and not owned by an MJPEG stream */
+static int
+cam_check_readable(mc_camera *cam)
+{
+    if (!cam->streaming) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: Camera has not been started", cam->device ? cam->device : "");
+        return MC_ERR_STATE;
+    }
+    if (cam->stream) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: Camera is serving an MJPEG stream", cam->device);
+        return MC_ERR_STATE;
+    }
+    return MC_OK;
+}
+
+/* Timestamp jitter to absorb: half a sensor frame */
+static uint64_t
+cam_tolerance(const mc_camera *cam)
+{
+    return (cam->fps > 0) ? (uint64_t) (0.5e6 / cam->fps) : 0;
+}
+
+/* Is a frame with timestamp `ts` due for output at the camera's target rate? */
+static int
+cam_frame_due(mc_camera *cam, uint64_t ts)
+{
+    uint64_t period;
+
+    if (cam->rate <= 0) return 1;
+    period = (uint64_t) (1e6 / cam->rate);
+    if (cam->next_due_us && ts + cam_tolerance(cam) < cam->next_due_us) return 0; //Accept slightly early frames
+
+    if (cam->next_due_us && cam->next_due_us + period > ts)
+        cam->next_due_us += period;
+    else //First frame, or fell behind
+        cam->next_due_us = ts + period;
+    return 1;
+}
+
+/* Dequeue a buffer into `cam->pending` */
+static int
+cam_dequeue(mc_camera *cam)
+{
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (-1 == v4l2_xioctl(cam->fd, VIDIOC_DQBUF, &buf)) {
+        mc_seterr(cam, MC_ERR_DQBUF, "%s: ioctl(VIDIOC_DQBUF) failure : %d, %s", cam->device, errno, strerror(errno));
+        return MC_ERR_DQBUF;
+    }
+    cam->pending = buf.index;
+    cam->pending_info.timestamp_us = (uint64_t) buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    if (!cam->pending_info.timestamp_us) //Driver without timestamps
+        cam->pending_info.timestamp_us = now_us();
+    cam->pending_info.sequence = buf.sequence;
+    cam->pending_info.bytesused = buf.bytesused;
+    return MC_OK;
+}
+
+/* Give buffer `index` back to the driver */
+static int
+cam_queue(mc_camera *cam, int index)
+{
+    struct v4l2_buffer buf;
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (-1 == v4l2_xioctl(cam->fd, VIDIOC_QBUF, &buf)) {
+        mc_seterr(cam, MC_ERR_QBUF, "%s: ioctl(VIDIOC_QBUF) failure : %d, %s", cam->device, errno, strerror(errno));
+        return MC_ERR_QBUF;
+    }
+    return MC_OK;
+}
+
+/* Give `cam->pending` back to the driver */
+static int
+cam_requeue(mc_camera *cam)
+{
+    int index = cam->pending;
+    cam->pending = -1;
+    return cam_queue(cam, index);
+}
+
+/*
+ * Make sure `cam->pending` holds a frame that is due for output. Frames above
+ * the target rate are re-queued without being decoded.
+ * `timeout_ms` < 0 blocks, 0 only takes frames that are already available.
+ */
+static int
+cam_grab(mc_camera *cam, int timeout_ms)
+{
+    uint64_t deadline = (timeout_ms >= 0) ? now_us() + (uint64_t) timeout_ms * 1000 : 0;
+    int res;
+
+    while (cam->pending == -1) {
+        if (timeout_ms >= 0) {
+            res = cam_wait_frame(cam, ms_left(deadline));
+            if (res < 0) return cam->err;
+            if (res == 0) {
+                if (timeout_ms > 0)
+                    mc_seterr(cam, MC_ERR_TIMEOUT, "%s: No frame within %i ms", cam->device, timeout_ms);
+                return MC_ERR_TIMEOUT;
+            }
+        }
+        if ((res = cam_dequeue(cam)) != MC_OK) return res;
+        if (!cam_frame_due(cam, cam->pending_info.timestamp_us)) {
+            if ((res = cam_requeue(cam)) != MC_OK) return res;
+        }
+    }
+    return MC_OK;
+}
+
+/*
+ * Like cam_grab(), then skip ahead to the newest due frame that has already
+ * been captured. Capture only advances while a camera is read, so without this
+ * a camera read at a lower rate than its sensor returns the oldest of its
+ * queued buffers, and groups of cameras read together drift apart.
+ */
+static int
+cam_grab_latest(mc_camera *cam, int timeout_ms)
+{
+    mc_frame_info older_info;
+    int older, res;
+
+    if ((res = cam_grab(cam, timeout_ms)) != MC_OK) return res;
+    //At most all buffers hold captured frames; stop there rather than chase live capture
+    for (unsigned int i=0; i<cam->n_buffers; i++) {
+        older = cam->pending;
+        older_info = cam->pending_info;
+        cam->pending = -1;
+        res = cam_grab(cam, 0);
+        if (res != MC_OK) { //MC_ERR_TIMEOUT: no newer due frame
+            cam->pending = older;
+            cam->pending_info = older_info;
+            return (res == MC_ERR_TIMEOUT) ? MC_OK : res;
+        }
+        if ((res = cam_queue(cam, older)) != MC_OK) return res;
+    }
+    return MC_OK;
+}
+
+/*
+ * Replace `cam->pending` by the first frame captured at `ref_us` or later, due
+ * or not, so cameras read together share the time of the newest frame of the
+ * group. The target rate then counts from the new frame.
+ */
+static int
+cam_catch_up(mc_camera *cam, uint64_t ref_us, int timeout_ms)
+{
+    uint64_t deadline = (timeout_ms >= 0) ? now_us() + (uint64_t) timeout_ms * 1000 : 0;
+    int res;
+
+    while (cam->pending_info.timestamp_us + cam_tolerance(cam) < ref_us) {
+        if ((res = cam_requeue(cam)) != MC_OK) return res;
+        if (timeout_ms >= 0) {
+            res = cam_wait_frame(cam, ms_left(deadline));
+            if (res < 0) return cam->err;
+            if (res == 0) {
+                mc_seterr(cam, MC_ERR_TIMEOUT, "%s: No frame within %i ms", cam->device, timeout_ms);
+                return MC_ERR_TIMEOUT;
+            }
+        }
+        if ((res = cam_dequeue(cam)) != MC_OK) return res;
+    }
+    if (cam->rate > 0)
+        cam->next_due_us = cam->pending_info.timestamp_us + (uint64_t) (1e6 / cam->rate);
+    return MC_OK;
+}
+
+/* Grow the camera's conversion scratch buffer to at least `size` bytes, on the camera's NUMA node */
+static uint8_t *
+cam_scratch(mc_camera *cam, size_t size)
+{
+    if (cam->scratch_size < size) {
+        uint8_t *p = mcnuma_alloc(size, cam->numa_node);
+        if (!p) return NULL;
+        mcnuma_free(cam->scratch, cam->scratch_size);
+        cam->scratch = p;
+        cam->scratch_size = size;
+    }
+    return cam->scratch;
+}
+
+/*
+ * Decode `cam->pending` into `out` and give the buffer back to the driver.
+ * The frame is remapped if the camera has a remap, and scaled if the output
+ * size differs from the camera size. Without scaling, the remap writes packed
+ * RGB straight into `out`.
+ */
+static int
+cam_decode(mc_camera *cam, const CamOutput *out, mc_frame_info *info)
+{
+    int libyuv_res;
+    unsigned int index = cam->pending;
+    int scaled = (out->width != cam->width || out->height != cam->height);
+    size_t argb_size = (size_t) cam->height * cam->width * 4;
+
+    uint8_t *argb = cam_scratch(cam, argb_size * ((cam->remap && scaled) ? 2 : 1) +
+                                     (scaled ? (size_t) out->width * out->height * 4 : 0));
+    uint8_t *next = argb + argb_size;
+    if (!argb) {
+        cam_requeue(cam);
+        mc_seterr(cam, MC_ERR_MEMORY, "Out of memory");
+        return MC_ERR_MEMORY;
+    }
+    if (info) *info = cam->pending_info;
+
+    //Convert to ARGB
+    libyuv_res = ConvertToARGB(
+                   (uint8_t *) cam->buffers[index].start, //sample
+                   cam->buffers[index].length, //sample_size
+                   argb, cam->width*4, //dst, dst_stride
+                   0, 0, //crop_x, crop_y
+                   cam->width, cam->height,
+                   cam->width, cam->height,
+                   kRotate0, //RotationMode
+                   cam->fourcc); //FOURCC
+
+    if (libyuv_res != 0) {
+        cam_requeue(cam);
+        mc_seterr(cam, MC_ERR_CONVERT, "%s: libyuv ConvertToARGB failed: %i", cam->device, libyuv_res);
+        return MC_ERR_CONVERT;
+    }
+    //Re-queue buffer
+    if (cam_requeue(cam) != MC_OK)
+        return MC_ERR_QBUF;
+    //Undistort/rectify
+    if (cam->remap && !scaled) {
+        remap_argb_to_raw(cam->remap, argb, out->dst, out->stride);
+        return MC_OK;
+    }
+    if (cam->remap) {
+        remap_argb(cam->remap, argb, next, cam->width*4);
+        argb = next;
+        next += argb_size;
+    }
+    //Scale to output size
+    if (scaled) {
+        uint8_t *argb_scaled = next;
+        libyuv_res = ARGBScale(argb, cam->width*4, cam->width, cam->height,
+                               argb_scaled, out->width*4, out->width, out->height, kFilterBilinear);
+        if (libyuv_res != 0) {
+            mc_seterr(cam, MC_ERR_OUTPUT, "%s: libyuv ARGBScale failed: %i", cam->device, libyuv_res);
+            return MC_ERR_OUTPUT;
+        }
+        argb = argb_scaled;
+    }
+    //Convert to RGB, put in dst
+    libyuv_res = ARGBToRAW(argb, out->width*4, out->dst, out->stride, out->width, out->height);
+    if (libyuv_res != 0) {
+        mc_seterr(cam, MC_ERR_OUTPUT, "%s: libyuv ARGBToRAW failed: %i", cam->device, libyuv_res);
+        return MC_ERR_OUTPUT;
+    }
+    return MC_OK;
+}
+
+static void *
+cam_read_worker(void *argp)
+{
+    CamReadWorkerArgStruct *args = argp;
+    mc_camera *cam = args->cam;
+
+    args->res = cam_grab(cam, args->timeout_ms);
+    if (args->res == MC_OK)
+        args->res = cam_decode(cam, &args->out, args->info);
+    if (args->res == MC_OK && args->mosaic)
+        mosaic_apply_overlay(args->mosaic, args->tile, args->out.dst - mosaic_offset(args->mosaic, args->tile));
+    return NULL;
+}
+
+/*
+ * Report a grabbed frame (or a failure) and wait for the other workers.
+ * Returns the timestamp of the newest frame of the group, or 0 if any failed.
+ */
+static uint64_t
+camsys_sync_wait(CamsysSync *sync, int res, uint64_t ts)
+{
+    uint64_t ref;
+
+    pthread_mutex_lock(&sync->lock);
+    if (res != MC_OK) sync->failed = 1;
+    else if (ts > sync->ref_us) sync->ref_us = ts;
+    if (--sync->grabbing == 0)
+        pthread_cond_broadcast(&sync->cond);
+    while (sync->grabbing > 0)
+        pthread_cond_wait(&sync->cond, &sync->lock);
+    ref = sync->failed ? 0 : sync->ref_us;
+    pthread_mutex_unlock(&sync->lock);
+    return ref;
+}
+
+/* Release the workers waiting for `n` workers that were not started */
+static void
+camsys_sync_cancel(CamsysSync *sync, int n)
+{
+    pthread_mutex_lock(&sync->lock);
+    sync->failed = 1;
+    sync->grabbing -= n;
+    pthread_cond_broadcast(&sync->cond);
+    pthread_mutex_unlock(&sync->lock);
+}
+
+/*
+ * Read worker of a camera system. Every camera grabs its newest due frame;
+ * cameras behind the newest frame of the group then catch up to it, so frames
+ * of cameras with different rates are taken at about the same time.
+ */
+static void *
+camsys_read_worker(void *argp)
+{
+    CamReadWorkerArgStruct *args = argp;
+    mc_camera *cam = args->cam;
+    uint64_t deadline = (args->timeout_ms >= 0) ? now_us() + (uint64_t) args->timeout_ms * 1000 : 0;
+    uint64_t ref;
+    int res;
+
+    res = cam_grab_latest(cam, args->timeout_ms);
+    ref = camsys_sync_wait(args->sync, res, (res == MC_OK) ? cam->pending_info.timestamp_us : 0);
+    if (res == MC_OK && ref)
+        res = cam_catch_up(cam, ref, ms_left(deadline));
+    args->res = res;
+    if (res == MC_OK) cam_read_worker(args); //Decodes the grabbed frame
+    return NULL;
+}
+
+/*
+ * Run a read worker in a thread with the camera's affinity and priority if it
+ * has any, or else here. A thread that cannot be started is an error; the
+ * read never runs unpinned instead.
+ */
+static int
+cam_read_run(CamReadWorkerArgStruct *args)
+{
+    mc_camera *cam = args->cam;
+    pthread_t thread;
+    int r;
+
+    if (!cam->n_cpus && !cam->rt_priority) {
+        cam_read_worker(args);
+        return args->res;
+    }
+    if ((r = cam_thread_create(cam, &thread, cam_read_worker, args, 1)) != 0)
+        return args->res = cam_thread_error(cam, r);
+    pthread_join(thread, NULL);
+    return args->res;
+}
+
+int
+mc_cam_read_timeout(mc_camera *cam, uint8_t *dst, int timeout_ms, mc_frame_info *info)
+{
+    CamReadWorkerArgStruct args = {cam, cam_output(cam, dst), timeout_ms, info, NULL, 0, 0};
+    int res;
+
+    if ((res = cam_check_readable(cam)) != MC_OK) return res;
+    return cam_read_run(&args);
+}
+
+int
+mc_cam_read(mc_camera *cam, uint8_t *dst, mc_frame_info *info)
+{
+    return mc_cam_read_timeout(cam, dst, -1, info);
+}
+
+int
+mc_sched_next(mc_camera **cams, int n, uint8_t *dst, int timeout_ms, int *index, mc_frame_info *info)
+{
+    uint64_t deadline = (timeout_ms >= 0) ? now_us() + (uint64_t) timeout_ms * 1000 : 0;
+    struct pollfd pfds[n > 0 ? n : 1];
+    int res, best, r;
+
+    *index = -1;
+    if (n <= 0) return MC_ERR_ARG;
+    for (int i=0; i<n; i++) {
+        if ((res = cam_check_readable(cams[i])) != MC_OK) {
+            *index = i;
+            return res;
+        }
+        pfds[i] = (struct pollfd){cams[i]->fd, POLLIN, 0};
+    }
+
+    for (;;) {
+        //Collect due frames from all cameras, and pick the oldest
+        best = -1;
+        for (int i=0; i<n; i++) {
+            res = cam_grab(cams[i], 0);
+            if (res != MC_OK && res != MC_ERR_TIMEOUT) {
+                *index = i;
+                return res;
+            }
+            if (cams[i]->pending != -1 &&
+                (best == -1 || cams[i]->pending_info.timestamp_us < cams[best]->pending_info.timestamp_us))
+                best = i;
+        }
+        if (best != -1) { //Decode the pending frame with the camera's affinity and priority
+            CamReadWorkerArgStruct args = {cams[best], cam_output(cams[best], dst), 0, info, NULL, 0, 0};
+            *index = best;
+            return cam_read_run(&args);
+        }
+
+        //Nothing due yet; wait for any camera
+        do {
+            r = poll(pfds, n, ms_left(deadline));
+        }
+        while (r == -1 && errno == EINTR);
+        if (r == -1) {
+            mc_seterr(cams[0], MC_ERR_DQBUF, "poll failure : %d, %s", errno, strerror(errno));
+            *index = 0;
+            return MC_ERR_DQBUF;
+        }
+        if (r == 0) return MC_ERR_TIMEOUT;
+    }
+}
+
+/* Check that all cameras can be read */
+static int
+camsys_check(mc_camera **cams, int n, int *failed)
+{
+    int res;
+
+    if (n <= 0) return MC_ERR_ARG;
+    for (int i=0; i<n; i++) {
+        if ((res = cam_check_readable(cams[i])) != MC_OK) {
+            if (failed) *failed = i;
+            return res;
+        }
+    }
+    return MC_OK;
+}
+
+/*
+ * Run one read worker thread per camera. `idle` is called while waiting, if
+ * not NULL. If a thread cannot be started, the threads already running are
+ * joined and the error is returned; cameras are never read one after another.
+ */
+static int
+camsys_run(CamReadWorkerArgStruct *cam_args, int n, void (*idle)(void *), void *idle_arg, int *failed)
+{
+    pthread_t *threads = (pthread_t *) malloc(n*sizeof(pthread_t));
+    CamsysSync sync = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, n, 0, 0};
+    int res = MC_OK, started, r;
+
+    if (!threads) return MC_ERR_MEMORY;
+    for (started=0; started<n; started++) { //Run threads
+        cam_args[started].sync = &sync;
+        r = cam_thread_create(cam_args[started].cam, &(threads[started]), camsys_read_worker, (void *)(&cam_args[started]), 1);
+        if (r != 0) {
+            res = cam_thread_error(cam_args[started].cam, r);
+            if (failed) *failed = started;
+            camsys_sync_cancel(&sync, n - started);
+            break;
+        }
+    }
+    if (idle && res == MC_OK) idle(idle_arg);
+    for (int i=0; i<started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&sync.cond);
+    pthread_mutex_destroy(&sync.lock);
+    for (int i=0; i<n && res == MC_OK; i++) { //Check for errors
+        if (cam_args[i].res) {
+            res = cam_args[i].res;
+            if (failed) *failed = i;
+        }
+    }
+    free(threads);
+    return res;
+}
+
+int
+mc_camsys_read(mc_camera **cams, int n, uint8_t *dst, int timeout_ms, mc_frame_info *info, int *failed)
+{
+    CamReadWorkerArgStruct *cam_args = NULL;
+    int res;
+    size_t offset = 0;
+
+    if (failed) *failed = -1;
+    if ((res = camsys_check(cams, n, failed)) != MC_OK) return res;
+
+    cam_args = (CamReadWorkerArgStruct *) malloc(n*sizeof(CamReadWorkerArgStruct));
+    if (!cam_args) return MC_ERR_MEMORY;
+
+    for (int i=0; i<n; i++) { //Prepare thread args
+        cam_args[i] = (CamReadWorkerArgStruct){cams[i], cam_output(cams[i], &dst[offset]), timeout_ms, info ? &info[i] : NULL, NULL, 0, 0};
+        offset += mc_cam_frame_size(cams[i]);
+    }
+    res = camsys_run(cam_args, n, NULL, NULL, failed);
+    free(cam_args);
+    return res;
+}
+
+typedef struct MosaicBackgroundArgStruct {
+    const mc_mosaic *m;
+    uint8_t *dst;
+} MosaicBackgroundArgStruct;
+
+static void
+mosaic_background(void *argp)
+{
+    MosaicBackgroundArgStruct *args = argp;
+    mosaic_apply_overlay(args->m, args->m->n, args->dst);
+}
+
+int
+mc_camsys_read_mosaic(mc_camera **cams, const int *tiles, int n, const mc_mosaic *m,
+                      uint8_t *dst, int timeout_ms, mc_frame_info *info, int *failed)
+{
+    CamReadWorkerArgStruct *cam_args = NULL;
+    MosaicBackgroundArgStruct background = {m, dst};
+    int res, tile;
+
+    if (failed) *failed = -1;
+    if ((res = camsys_check(cams, n, failed)) != MC_OK) return res;
+    for (int i=0; i<n; i++) {
+        tile = tiles ? tiles[i] : i;
+        if (tile < 0 || tile >= m->n) {
+            mc_seterr(cams[i], MC_ERR_ARG, "%s: No tile %i in mosaic", cams[i]->device, tile);
+            if (failed) *failed = i;
+            return MC_ERR_ARG;
+        }
+        for (int j=0; tiles && j<i; j++) { //Cameras are written in parallel
+            if (tiles[j] == tile) {
+                mc_seterr(cams[i], MC_ERR_ARG, "%s: Tile %i is already used by camera %i", cams[i]->device, tile, j);
+                if (failed) *failed = i;
+                return MC_ERR_ARG;
+            }
+        }
+    }
+
+    cam_args = (CamReadWorkerArgStruct *) malloc(n*sizeof(CamReadWorkerArgStruct));
+    if (!cam_args) return MC_ERR_MEMORY;
+
+    for (int i=0; i<n; i++) { //Prepare thread args
+        tile = tiles ? tiles[i] : i;
+        CamOutput out = {&dst[mosaic_offset(m, tile)], m->width*3, m->tiles[tile].width, m->tiles[tile].height};
+        cam_args[i] = (CamReadWorkerArgStruct){cams[i], out, timeout_ms, info ? &info[i] : NULL, m, tile, 0};
+    }
+    //Overlay outside the tiles is drawn while the cameras are read
+    res = camsys_run(cam_args, n, mosaic_background, &background, failed);
+    free(cam_args);
+    return res;
+}
+
+/*
+ * MJPEG streaming
+ */
+
+/* Capture thread of a stream: copies each due payload into the ring, undecoded */
+static void *
+cam_stream_worker(void *arg)
+{
+    mc_stream *s = arg;
+    mc_camera *cam = s->cam;
+    StreamSlot *slot;
+    size_t size;
+    int res = MC_OK;
+
+    while (!atomic_load(&s->stop)) {
+        res = cam_grab(cam, 100); //Wake up regularly to check for stop
+        if (res == MC_ERR_TIMEOUT) continue;
+        if (res != MC_OK) break;
+        if ((slot = stream_free_slot(s))) {
+            size = cam->pending_info.bytesused ? cam->pending_info.bytesused : cam->buffers[cam->pending].length;
+            if (size > slot->capacity) size = slot->capacity;
+            memcpy(slot->data, cam->buffers[cam->pending].start, size);
+            slot->size = size;
+            slot->info = cam->pending_info;
+        }
+        if ((res = cam_requeue(cam)) != MC_OK) break;
+        if (slot) stream_publish(s, slot);
+        res = MC_OK;
+    }
+    if (res != MC_OK && res != MC_ERR_TIMEOUT) atomic_store(&s->res, res);
+    return NULL;
+}
+
+int
+mc_cam_serve_mjpeg(mc_camera *cam, const char *address, int port, int n_slots)
+{
+    size_t capacity = 0;
+    mc_stream *s;
+    int res, r;
+
+    if (!cam->streaming) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: Camera has not been started", cam->device ? cam->device : "");
+        return MC_ERR_STATE;
+    }
+    if (cam->stream) {
+        mc_seterr(cam, MC_ERR_STATE, "%s: Camera is already serving an MJPEG stream", cam->device);
+        return MC_ERR_STATE;
+    }
+    if (cam->fourcc != V4L2_PIX_FMT_MJPEG && cam->fourcc != V4L2_PIX_FMT_JPEG) {
+        mc_seterr(cam, MC_ERR_ARG, "%s: MJPEG streaming needs format MJPG", cam->device);
+        return MC_ERR_ARG;
+    }
+    if (!n_slots) n_slots = STREAM_SLOTS;
+    if (n_slots < 2) { //The latest frame stays readable while the next is captured
+        mc_seterr(cam, MC_ERR_ARG, "%s: An MJPEG stream needs at least 2 slots", cam->device);
+        return MC_ERR_ARG;
+    }
+    for (unsigned int i=0; i<cam->n_buffers; i++)
+        if (cam->buffers[i].length > capacity) capacity = cam->buffers[i].length;
+
+    if ((res = stream_create(&s, cam, address, port, n_slots, capacity)) != MC_OK) return res;
+    if ((res = stream_start_server(s)) != MC_OK) {
+        stream_destroy(s);
+        return res;
+    }
+    if ((r = cam_thread_create(cam, &s->producer, cam_stream_worker, s, 1)) != 0) {
+        stream_destroy(s);
+        mc_seterr(cam, MC_ERR_STREAM, "%s: Cannot start capture thread : %d, %s", cam->device, r, strerror(r));
+        return MC_ERR_STREAM;
+    }
+    s->producer_started = 1;
+    cam->stream = s;
+    return MC_OK;
+}
+
+void
+mc_cam_serve_stop(mc_camera *cam)
+{
+    mc_stream *s = cam->stream;
+
+    if (!s) return;
+    atomic_store(&s->stop, 1);
+    if (s->producer_started) pthread_join(s->producer, NULL);
+    cam->stream = NULL;
+    stream_destroy(s);
+}
+
+int
+mc_cam_serve_info(const mc_camera *cam, mc_stream_info *info)
+{
+    mc_stream *s = cam->stream;
+
+    if (!s) return MC_ERR_STATE;
+    info->port = s->port;
+    info->clients = atomic_load(&s->stat_clients);
+    info->frames = atomic_load(&s->stat_frames);
+    info->dropped = atomic_load(&s->stat_dropped);
+    info->sent = atomic_load(&s->stat_sent);
+    return atomic_load(&s->res);
+}
+
+void *
+mc_alloc_frames(mc_camera **cams, int n, size_t frame_size)
+{
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    uint8_t *p = mcnuma_alloc(n * frame_size, -1);
+
+    if (!p) return NULL;
+    for (int i=0; i<n; i++) { //Whole pages within frame i
+        size_t start = (i * frame_size + page - 1) / page * page;
+        size_t end = (i + 1) * frame_size / page * page;
+        if (cams[i]->numa_node >= 0 && end > start)
+            mcnuma_bind(p + start, end - start, cams[i]->numa_node);
+    }
+    return p;
+}
+
+void
+mc_free_frames(void *p, int n, size_t frame_size)
+{
+    mcnuma_free(p, n * frame_size);
+}
+
+/*
+ * Utils
+ */
+int
+mc_is_valid_device(const char *device)
+{
+    int fd = open(device, O_RDONLY, 0);
+    if (fd == -1) return 0;
+    int res = v4l2_test_valid_device(fd, device, NULL);
+    close(fd);
+    return res;
+}
+
+const char *
+mc_cam_error(const mc_camera *cam)
+{
+    return cam->errmsg;
+}
+
+const char *
+mc_strerror(int status)
+{
+    switch (status) {
+        case MC_OK:          return "Success";
+        case MC_ERR_DQBUF:   return "Dequeueing buffer failed";
+        case MC_ERR_CONVERT: return "Decoding frame failed";
+        case MC_ERR_QBUF:    return "Re-queueing buffer failed";
+        case MC_ERR_OUTPUT:  return "Converting to output format failed";
+        case MC_ERR_TIMEOUT: return "Timed out waiting for frame";
+        case MC_ERR_DEVICE:  return "Device error";
+        case MC_ERR_MEMORY:  return "Memory error";
+        case MC_ERR_STREAM:  return "Stream error";
+        case MC_ERR_ARG:     return "Invalid argument";
+        case MC_ERR_STATE:   return "Invalid camera state";
+        case MC_ERR_PERM:    return "Operation not permitted";
+        default:             return "Unknown error";
+    }
+}
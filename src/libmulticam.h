@@ -0,0 +1,268 @@
+#ifndef LIBMULTICAM_H
+#define LIBMULTICAM_H
+/*
+ * libmulticam: native V4L2 capture and conversion core.
+ *
+ * Plain C API without any dependency on CPython. A camera is described by an
+ * `mc_camera` struct owned by the caller; frames are converted to packed RGB
+ * (height x width x 3) into caller-provided buffers.
+ *
+ * Unless noted otherwise, functions return MC_OK (0) on success and one of the
+ * `mc_status` codes on failure. A human readable description of the last
+ * failure is kept in `cam->errmsg` (see mc_cam_error()).
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only the mc_* API is exported; the library is built with -fvisibility=hidden */
+#if defined(__GNUC__)
+#define MC_API __attribute__((visibility("default")))
+#else
+#define MC_API
+#endif
+
+#define MC_ERRMSG_LEN 256
+
+typedef enum mc_status {
+    MC_OK = 0,
+    MC_ERR_DQBUF = 1,       /* ioctl(VIDIOC_DQBUF) failed */
+    MC_ERR_CONVERT = 2,     /* Decoding the captured frame failed */
+    MC_ERR_QBUF = 3,        /* ioctl(VIDIOC_QBUF) failed */
+    MC_ERR_OUTPUT = 4,      /* Converting to the output format failed */
+    MC_ERR_TIMEOUT = 5,     /* No frame arrived within the timeout */
+    MC_ERR_DEVICE = 6,      /* Device could not be opened or configured */
+    MC_ERR_MEMORY = 7,      /* Buffer allocation or memory mapping failed */
+    MC_ERR_STREAM = 8,      /* Starting or stopping the stream failed */
+    MC_ERR_ARG = 9,         /* Invalid argument */
+    MC_ERR_STATE = 10,      /* Camera is not in the required state */
+    MC_ERR_PERM = 11,       /* Not permitted (e.g. real-time scheduling) */
+} mc_status;
+
+/* Memory mapped V4L2 buffer */
+typedef struct mc_buffer {
+    void * start;
+    size_t length;
+} mc_buffer;
+
+typedef struct mc_frame_info {
+    uint64_t timestamp_us;  /* Driver timestamp (usually CLOCK_MONOTONIC) */
+    uint32_t sequence;      /* Driver frame sequence number */
+    uint32_t bytesused;     /* Size of the captured payload */
+} mc_frame_info;
+
+/*
+ * Precomputed undistortion/rectification. For every output pixel, in tiles of
+ * MC_REMAP_TILE x MC_REMAP_TILE pixels, the table holds the index of the
+ * top-left source neighbour and four fixed-point bilinear weights (sum 1<<14,
+ * all 0 if the pixel maps outside the source).
+ */
+#define MC_REMAP_TILE 32
+#define MC_REMAP_BITS 14
+
+typedef struct mc_remap {
+    int src_width;
+    int src_height;
+    int width;
+    int height;
+    int32_t *offset;
+    int16_t *weights;
+} mc_remap;
+
+/* MJPEG stream server of a camera (see mc_cam_serve_mjpeg()) */
+typedef struct mc_stream mc_stream;
+
+typedef struct mc_camera {
+    char* device;
+    uint32_t fourcc;
+    mc_buffer* buffers;
+    unsigned int n_buffers;
+    int width;
+    int height;
+    float fps;
+    int fd;
+    int streaming;
+    float rate;                 /* Target output rate, 0 for every frame */
+    uint64_t next_due_us;       /* Earliest timestamp of the next frame to output */
+    int pending;                /* Dequeued, not yet decoded buffer or -1 */
+    mc_frame_info pending_info;
+    const mc_remap *remap;      /* Undistortion applied while converting, or NULL */
+    int *cpus;                  /* CPUs for capture and conversion threads, or NULL for any */
+    int n_cpus;
+    int numa_node;              /* NUMA node of `cpus`, or -1 */
+    int rt_priority;            /* SCHED_FIFO priority of the dequeue thread, 0 for normal */
+    mc_stream *stream;          /* MJPEG stream owning the capture, or NULL */
+    uint8_t *scratch;           /* Conversion scratch buffer, reused between frames */
+    size_t scratch_size;
+    int err;
+    char errmsg[MC_ERRMSG_LEN];
+} mc_camera;
+
+/* Placement of one camera in a mosaic */
+typedef struct mc_tile {
+    int x;
+    int y;
+    int width;      /* Frames are scaled to the tile size */
+    int height;
+} mc_tile;
+
+/* Horizontal run of overlay pixels */
+typedef struct mc_span {
+    int y;
+    int x;
+    int length;
+} mc_span;
+
+/*
+ * Mosaic layout: cameras are converted directly into their tile of a single
+ * (height x width x 3) RGB buffer. An optional overlay (borders, labels, ...)
+ * is precomputed into spans so applying it only touches the masked pixels.
+ */
+typedef struct mc_mosaic {
+    int width;
+    int height;
+    int n;                  /* Number of tiles */
+    mc_tile *tiles;
+    uint8_t *overlay;       /* (height x width x 3) RGB or NULL */
+    mc_span *spans;         /* Overlay spans grouped by tile; spans outside all tiles last */
+    int *span_start;        /* n+2 entries; spans of tile i are [span_start[i], span_start[i+1]) */
+} mc_mosaic;
+
+/* Lifecycle */
+MC_API int mc_cam_init(mc_camera *cam, const char *device);
+MC_API int mc_cam_configure(mc_camera *cam, int width, int height, const char *format, float fps);
+MC_API int mc_cam_open(mc_camera *cam);
+MC_API int mc_cam_start(mc_camera *cam);
+MC_API int mc_cam_stop(mc_camera *cam);
+MC_API void mc_cam_destroy(mc_camera *cam);
+
+/*
+ * Decimate the camera to at most `rate` frames per second (0: every frame).
+ * Frames above the target rate are handed back to the driver without being
+ * decoded, so conversion cost follows the output rate, not the sensor rate.
+ */
+MC_API int mc_cam_set_rate(mc_camera *cam, float rate);
+
+/* Apply `remap` (or none if NULL) to all frames. The remap must match the camera size and outlive its use. */
+MC_API int mc_cam_set_remap(mc_camera *cam, const mc_remap *remap);
+
+/*
+ * Run capture and conversion of the camera on `cpus` (NULL/0: any CPU). CPUs
+ * outside the process's affinity (offline, or excluded by a cpuset) fail with
+ * MC_ERR_ARG. Scratch memory then follows the NUMA node of the CPUs. With an
+ * affinity or real-time priority, reads always run in a worker thread with
+ * these settings; if it cannot be started, the read fails.
+ */
+MC_API int mc_cam_set_affinity(mc_camera *cam, const int *cpus, int n);
+/*
+ * Dequeue and convert frames in a SCHED_FIFO thread with `priority` (0: normal
+ * scheduling). Returns MC_ERR_PERM, and keeps normal scheduling, if the
+ * process is not allowed to use real-time scheduling. Other failures to start
+ * the thread are errors, and keep the previous priority.
+ */
+MC_API int mc_cam_set_realtime(mc_camera *cam, int priority);
+
+/* Reading. `dst` must hold mc_cam_frame_size() bytes; `info` may be NULL. */
+MC_API size_t mc_cam_frame_size(const mc_camera *cam);
+MC_API int mc_cam_read(mc_camera *cam, uint8_t *dst, mc_frame_info *info);
+MC_API int mc_cam_read_timeout(mc_camera *cam, uint8_t *dst, int timeout_ms, mc_frame_info *info);
+
+/*
+ * Read one frame from each of `n` cameras in parallel (one thread per camera).
+ * Frame i is written to `dst + i*mc_cam_frame_size(cams[i])`, so all cameras
+ * are expected to share the same size. Each camera grabs the newest due frame
+ * it has captured, skipping older queued ones; cameras behind the newest frame
+ * of the group then take their first frame captured after it, and count their
+ * rate from there. This keeps a group within about a sensor frame, even with
+ * different rates per camera; the timestamps in `info` give the actual skew.
+ * `info` may be NULL, otherwise it must hold `n` entries. `timeout_ms` < 0
+ * blocks. On failure, `failed` (if not NULL) is set to the index of the first
+ * camera that failed.
+ */
+MC_API int mc_camsys_read(mc_camera **cams, int n, uint8_t *dst, int timeout_ms, mc_frame_info *info, int *failed);
+
+/*
+ * Multi-rate scheduler: deliver the next frame from any of `n` cameras.
+ * Frames are returned in timestamp order across cameras (among the frames
+ * available at the time of the call), each camera decimated to its own rate.
+ * The frame is written to `dst` and its camera index to `index`. Returns
+ * MC_ERR_TIMEOUT with `index` = -1 if no camera delivered within `timeout_ms`.
+ */
+MC_API int mc_sched_next(mc_camera **cams, int n, uint8_t *dst, int timeout_ms, int *index, mc_frame_info *info);
+
+/*
+ * Serve the camera's MJPEG payloads, as captured and without decoding, to any
+ * number of HTTP clients as a multipart/x-mixed-replace stream. `address` is
+ * an IPv4/IPv6 address to listen on (NULL: 127.0.0.1) with `port` (0: any
+ * free port), or the path of a Unix domain socket (a stale socket file is
+ * replaced, one with a listening server fails with MC_ERR_STREAM). Frames pass
+ * through a ring of `n_slots` buffers (0: default); each client gets the
+ * latest frame when it has written the previous one, so slow clients skip
+ * frames instead of holding back capture. The camera must be started with
+ * format MJPG; it is read by the stream until mc_cam_serve_stop() (or
+ * mc_cam_stop()), and other reads fail with MC_ERR_STATE meanwhile.
+ */
+MC_API int mc_cam_serve_mjpeg(mc_camera *cam, const char *address, int port, int n_slots);
+MC_API void mc_cam_serve_stop(mc_camera *cam);
+
+typedef struct mc_stream_info {
+    int port;               /* TCP port listened on, or 0 for a Unix socket */
+    int clients;            /* Connected streaming clients */
+    uint64_t frames;        /* Frames captured into the ring */
+    uint64_t dropped;       /* Frames dropped because all slots were being sent */
+    uint64_t sent;          /* Frames written to clients (all clients together) */
+} mc_stream_info;
+
+/* Returns MC_ERR_STATE if the camera is not serving */
+MC_API int mc_cam_serve_info(const mc_camera *cam, mc_stream_info *info);
+
+/* Mosaic */
+MC_API int mc_mosaic_init(mc_mosaic *m, int width, int height, int n, const mc_tile *tiles);
+/* Pixels where `mask` (height x width) is nonzero are drawn from `overlay` after conversion */
+MC_API int mc_mosaic_set_overlay(mc_mosaic *m, const uint8_t *overlay, const uint8_t *mask);
+MC_API void mc_mosaic_destroy(mc_mosaic *m);
+MC_API size_t mc_mosaic_size(const mc_mosaic *m);
+
+/*
+ * Like mc_camsys_read(), but camera i is written to tile `tiles[i]` (distinct, or
+ * tile i if `tiles` is NULL) of the mosaic buffer `dst`. Pixels outside all
+ * tiles are only written where the overlay covers them, so `dst` should be
+ * zeroed or reused between reads.
+ */
+MC_API int mc_camsys_read_mosaic(mc_camera **cams, const int *tiles, int n, const mc_mosaic *m,
+                                 uint8_t *dst, int timeout_ms, mc_frame_info *info, int *failed);
+
+/* Remap */
+/* From absolute source coordinates per output pixel, as e.g. by OpenCV initUndistortRectifyMap (CV_32FC1) */
+MC_API int mc_remap_init_maps(mc_remap *r, int src_width, int src_height, int width, int height,
+                              const float *mapx, const float *mapy);
+/*
+ * From calibration: camera matrix `K` (3x3, row major), distortion `D`
+ * (k1, k2, p1, p2, k3), rectification `R` (3x3 or NULL for identity) and new
+ * camera matrix `P` (3x3 or NULL for K). The output has the source size.
+ */
+MC_API int mc_remap_init_calib(mc_remap *r, int width, int height, const double *K, const double *D,
+                               const double *R, const double *P);
+MC_API void mc_remap_destroy(mc_remap *r);
+
+/*
+ * Memory for `n` consecutive frames; frame i is placed on the NUMA node of
+ * cams[i]. Mapping and binding fault in fresh pages, so allocate once and
+ * reuse the buffer across reads.
+ */
+MC_API void *mc_alloc_frames(mc_camera **cams, int n, size_t frame_size);
+MC_API void mc_free_frames(void *p, int n, size_t frame_size);
+
+/* Utils */
+MC_API int mc_is_valid_device(const char *device);
+MC_API const char *mc_cam_error(const mc_camera *cam);
+MC_API const char *mc_strerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LIBMULTICAM_H
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libmulticam.h"
+#include "mosaic.h"
+
+/*
+ * Mosaic layouts: several cameras composed into one RGB frame.
+ */
+int
+mc_mosaic_init(mc_mosaic *m, int width, int height, int n, const mc_tile *tiles)
+{
+    memset(m, 0, sizeof(*m));
+    if (width <= 0 || height <= 0 || n <= 0 || !tiles) return MC_ERR_ARG;
+
+    for (int i=0; i<n; i++) {
+        const mc_tile *t = &tiles[i];
+        if (t->width <= 0 || t->height <= 0 || t->x < 0 || t->y < 0 ||
+            t->x + t->width > width || t->y + t->height > height)
+            return MC_ERR_ARG;
+        for (int j=0; j<i; j++) { //Tiles must not overlap
+            const mc_tile *u = &tiles[j];
+            if (t->x < u->x + u->width && u->x < t->x + t->width &&
+                t->y < u->y + u->height && u->y < t->y + t->height)
+                return MC_ERR_ARG;
+        }
+    }
+
+    m->tiles = malloc(n * sizeof(mc_tile));
+    m->span_start = calloc(n + 2, sizeof(int));
+    if (!m->tiles || !m->span_start) {
+        mc_mosaic_destroy(m);
+        return MC_ERR_MEMORY;
+    }
+    memcpy(m->tiles, tiles, n * sizeof(mc_tile));
+    m->width = width;
+    m->height = height;
+    m->n = n;
+    return MC_OK;
+}
+
+/* Tile containing (x,y), or -1 if none. `end` is set to where that ends on the row. */
+static int
+tile_at(const mc_mosaic *m, int x, int y, int *end)
+{
+    *end = m->width;
+    for (int i=0; i<m->n; i++) {
+        const mc_tile *t = &m->tiles[i];
+        if (y < t->y || y >= t->y + t->height) continue;
+        if (x >= t->x && x < t->x + t->width) {
+            *end = t->x + t->width;
+            return i;
+        }
+        if (t->x > x && t->x < *end) //Next tile on this row
+            *end = t->x;
+    }
+    return -1;
+}
+
+int
+mc_mosaic_set_overlay(mc_mosaic *m, const uint8_t *overlay, const uint8_t *mask)
+{
+    size_t npix = (size_t) m->width * m->height;
+    mc_span *spans = NULL, *sorted = NULL;
+    int *group = NULL, *start;
+    int n_spans = 0, cap = 0, x, x1, end, g;
+
+    free(m->overlay);
+    free(m->spans);
+    m->overlay = NULL;
+    m->spans = NULL;
+    memset(m->span_start, 0, (m->n + 2) * sizeof(int));
+    if (!overlay || !mask) return MC_OK;
+
+    //Collect runs of masked pixels, split at tile edges
+    for (int y=0; y<m->height; y++) {
+        const uint8_t *row = &mask[(size_t) y * m->width];
+        for (x=0; x<m->width;) {
+            if (!row[x]) { x++; continue; }
+            for (x1=x; x1<m->width && row[x1]; x1++);
+            while (x < x1) {
+                g = tile_at(m, x, y, &end);
+                if (g == -1) g = m->n; //Outside all tiles
+                if (end > x1) end = x1;
+                if (n_spans == cap) {
+                    cap = cap ? 2*cap : 256;
+                    mc_span *s = realloc(spans, cap * sizeof(mc_span));
+                    int *gr = realloc(group, cap * sizeof(int));
+                    if (s) spans = s;
+                    if (gr) group = gr;
+                    if (!s || !gr) goto ERR_MEMORY;
+                }
+                spans[n_spans] = (mc_span){y, x, end - x};
+                group[n_spans++] = g;
+                x = end;
+            }
+        }
+    }
+
+    //Group spans by tile
+    start = m->span_start;
+    for (int i=0; i<n_spans; i++) start[group[i] + 1]++;
+    for (int i=0; i<=m->n; i++) start[i + 1] += start[i];
+    sorted = malloc((n_spans ? n_spans : 1) * sizeof(mc_span));
+    m->overlay = malloc(npix * 3);
+    if (!sorted || !m->overlay) goto ERR_MEMORY;
+    {
+        int fill[m->n + 1];
+        memcpy(fill, start, (m->n + 1) * sizeof(int));
+        for (int i=0; i<n_spans; i++) sorted[fill[group[i]]++] = spans[i];
+    }
+    memcpy(m->overlay, overlay, npix * 3);
+    m->spans = sorted;
+    free(spans);
+    free(group);
+    return MC_OK;
+
+    ERR_MEMORY:
+    free(spans);
+    free(group);
+    free(sorted);
+    free(m->overlay);
+    m->overlay = NULL;
+    memset(m->span_start, 0, (m->n + 2) * sizeof(int));
+    return MC_ERR_MEMORY;
+}
+
+void
+mc_mosaic_destroy(mc_mosaic *m)
+{
+    free(m->tiles);
+    free(m->span_start);
+    free(m->overlay);
+    free(m->spans);
+    memset(m, 0, sizeof(*m));
+}
+
+size_t
+mc_mosaic_size(const mc_mosaic *m)
+{
+    return (size_t) m->width * m->height * 3;
+}
+
+/* Byte offset of a tile's top-left pixel */
+size_t
+mosaic_offset(const mc_mosaic *m, int tile)
+{
+    return ((size_t) m->tiles[tile].y * m->width + m->tiles[tile].x) * 3;
+}
+
+/* Draw the overlay spans of `tile` (m->n: spans outside all tiles) onto the mosaic `dst` */
+void
+mosaic_apply_overlay(const mc_mosaic *m, int tile, uint8_t *dst)
+{
+    if (!m->overlay) return;
+    for (int i=m->span_start[tile]; i<m->span_start[tile + 1]; i++) {
+        size_t o = ((size_t) m->spans[i].y * m->width + m->spans[i].x) * 3;
+        memcpy(&dst[o], &m->overlay[o], (size_t) m->spans[i].length * 3);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef MOSAIC_H
+#define MOSAIC_H
+#include "libmulticam.h"
+size_t mosaic_offset(const mc_mosaic *m, int tile);
+void mosaic_apply_overlay(const mc_mosaic *m, int tile, uint8_t *dst);
+#endif //MOSAIC_H
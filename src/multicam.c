@@ -2,168 +2,325 @@
 #include <numpy/arrayobject.h>
 #include <structmember.h>
 #include <stdio.h>
-#include <pthread.h>
 #include <linux/videodev2.h>
 #include "libyuv.h"
 #include "multicam.h"
 #include "v4l2.h"
 #include <fcntl.h>   
 
-#define CLEAR(x) memset(&(x), 0, sizeof(x))
-#define STR2FOURCC(s) FOURCC(toupper(s[0]),toupper(s[1]),toupper(s[2]),toupper(s[3]))
+/* Raise the Python exception matching a libmulticam status code */
+static void
+mc_raise(mc_camera *cam, int err)
+{
+    PyObject *exc;
+    switch (err) {
+        case MC_ERR_MEMORY: exc = PyExc_MemoryError; break;
+        case MC_ERR_STREAM: exc = PyExc_EnvironmentError; break;
+        case MC_ERR_ARG:    exc = PyExc_ValueError; break;
+        case MC_ERR_TIMEOUT: exc = PyExc_TimeoutError; break;
+        case MC_ERR_DEVICE: exc = PyExc_SystemError; break;
+        default:            exc = PyExc_RuntimeError; break;
+    }
+    PyErr_SetString(exc, mc_cam_error(cam));
+}
+
+/*
+ * Claim the camera for the current call. Reads, start and stop run without
+ * the GIL, so the flag (only changed with the GIL held) keeps other threads
+ * from using or freeing the camera meanwhile. Returns 0 with RuntimeError set
+ * if the camera is in use.
+ */
+static int
+v4l2cam_acquire(v4l2camObject *self)
+{
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam is already in use");
+        return 0;
+    }
+    self->busy = 1;
+    return 1;
+}
+
+static void
+v4l2cam_release(v4l2camObject *self)
+{
+    self->busy = 0;
+}
 
 static int
 v4l2cam_init(v4l2camObject *self, PyObject *args, PyObject *kwargs)
 {
-    PyObject *device = NULL;//, *tmp;
-    static char *kwlist[] = {"device", "size", "format", "fps", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|(ii)sf", kwlist,
-                                    &device, &(self->width), &(self->height), &(self->format), &(self->fps)))
+    PyObject *device = NULL, *fspath;
+    int width = 0, height = 0, err;
+    char *format = NULL;
+    float fps = 0, rate = 0;
+    static char *kwlist[] = {"device", "size", "format", "fps", "rate", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|(ii)sff", kwlist,
+                                    &device, &width, &height, &format, &fps, &rate))
         return -1;        
-    PyObject *fspath = PyOS_FSPath(device);
-    self->device = (char *) PyUnicode_AsUTF8(fspath);
-    //Format
-    if (self->format) {
-        if (strlen(self->format) != 4) {
-           PyErr_Format(PyExc_ValueError, "`%s` is not a valid FOURCC", self->format);
-            return -1;
-        }
-        self->fourcc = STR2FOURCC(self->format);
+    fspath = PyOS_FSPath(device); //INCREF!
+    if (!fspath) return -1;
+    if (!PyUnicode_Check(fspath)) {
+        PyErr_SetString(PyExc_TypeError, "device must be a str or path-like object");
+        Py_DECREF(fspath);
+        return -1;
     }
-    else
-        self->fourcc = 0;
-    
-    self->buffers = NULL;
-    self->n_buffers = 0;
-    self->fd = -1;
+    if (!v4l2cam_acquire(self)) {
+        Py_DECREF(fspath);
+        return -1;
+    }
+    if (self->cam.device) mc_cam_destroy(&self->cam); //Re-initialization
+    Py_XSETREF(self->device, fspath);
+    Py_XSETREF(self->format, format ? PyUnicode_FromString(format) : NULL);
+
+    if ((err = mc_cam_init(&self->cam, PyUnicode_AsUTF8(fspath))) != MC_OK ||
+        (err = mc_cam_configure(&self->cam, width, height, format, fps)) != MC_OK ||
+        (err = mc_cam_set_rate(&self->cam, rate)) != MC_OK) {
+        mc_raise(&self->cam, err);
+        v4l2cam_release(self);
+        return -1;
+    }
+    v4l2cam_release(self);
     return 0;
 }
 
 static void
 v4l2cam_dealloc(v4l2camObject *self)
 {
+    if (self->cam.device) mc_cam_destroy(&self->cam);
     Py_XDECREF(self->device);
-    //Py_XDECREF(self->format);
+    Py_XDECREF(self->format);
+    Py_XDECREF(self->remap);
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
+static PyTypeObject remapType;
+
 PyObject *
-v4l2cam_start(v4l2camObject *self, PyObject *args)
+v4l2cam_set_remap(v4l2camObject *self, PyObject *remap)
 {
-    if (v4l2_open_device(self) == 0) {
-        v4l2_close_device(self);
+    int err;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
         return NULL;
     }
-    else {
-        int initres = v4l2_init_device(self);
-        if (initres == 0) {
-            v4l2_close_device(self);
-            return NULL;
+    if (remap != Py_None && !PyObject_TypeCheck(remap, &remapType)) {
+        PyErr_SetString(PyExc_TypeError, "remap must be a remap or None");
+        return NULL;
+    }
+    if (!v4l2cam_acquire(self)) return NULL;
+    //The camera keeps a reference while the remap is in use
+    err = mc_cam_set_remap(&self->cam, (remap == Py_None) ? NULL : &((remapObject *) remap)->r);
+    v4l2cam_release(self);
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
+        return NULL;
+    }
+    Py_INCREF(remap);
+    Py_XSETREF(self->remap, remap);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+v4l2cam_set_affinity(v4l2camObject *self, PyObject *cpus)
+{
+    PyObject *seq;
+    int n = 0, *list = NULL, err;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
+        return NULL;
+    }
+    if (cpus != Py_None) {
+        seq = PySequence_Fast(cpus, "cpus must be a sequence of CPU numbers or None"); //INCREF!
+        if (!seq) return NULL;
+        n = (int) PySequence_Fast_GET_SIZE(seq);
+        list = PyMem_Malloc((n ? n : 1) * sizeof(int));
+        if (!list) {
+            Py_DECREF(seq);
+            return PyErr_NoMemory();
         }
-        if (v4l2_start_capturing(self) == 0) {
-            v4l2_close_device(self);
+        for (int i=0; i<n; i++)
+            list[i] = (int) PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        Py_DECREF(seq);
+        if (PyErr_Occurred()) {
+            PyMem_Free(list);
             return NULL;
         }
     }
+    if (!v4l2cam_acquire(self)) {
+        PyMem_Free(list);
+        return NULL;
+    }
+    err = mc_cam_set_affinity(&self->cam, list, n);
+    v4l2cam_release(self);
+    PyMem_Free(list);
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
 PyObject *
-v4l2cam_stop(v4l2camObject *self, PyObject *args)
+v4l2cam_set_realtime(v4l2camObject *self, PyObject *arg)
 {
-    if (v4l2_stop_capturing(self) == 0)
-        return NULL;
-    if (v4l2_uninit_device(self) == 0)
+    int priority, err;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
         return NULL;
-    if (v4l2_close_device(self) == 0)
+    }
+    priority = (int) PyLong_AsLong(arg);
+    if (PyErr_Occurred()) return NULL;
+    if (!v4l2cam_acquire(self)) return NULL;
+    err = mc_cam_set_realtime(&self->cam, priority);
+    v4l2cam_release(self);
+    if (err == MC_ERR_PERM) { //Not fatal; capture runs with normal scheduling
+        if (PyErr_WarnEx(PyExc_RuntimeWarning, mc_cam_error(&self->cam), 1) < 0) return NULL;
+    }
+    else if (err != MC_OK) {
+        mc_raise(&self->cam, err);
         return NULL;
+    }
     Py_RETURN_NONE;
 }
 
-typedef struct CamReadWorkerArgStruct {
-    v4l2camObject *cam;
-    uint8_t *dst;
-    int res;
-} CamReadWorkerArgStruct;
+/* Serve the camera's MJPEG payloads over HTTP; returns the TCP port (0 for a Unix socket) */
+PyObject *
+v4l2cam_serve(v4l2camObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *address = Py_None, *fspath = NULL;
+    int port = 0, slots = 0, err;
+    mc_stream_info info;
+    static char *kwlist[] = {"address", "port", "slots", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oii", kwlist, &address, &port, &slots))
+        return NULL;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
+        return NULL;
+    }
+    if (address != Py_None) {
+        fspath = PyOS_FSPath(address); //INCREF!
+        if (!fspath) return NULL;
+        if (!PyUnicode_Check(fspath)) {
+            PyErr_SetString(PyExc_TypeError, "address must be a str or path-like object");
+            Py_DECREF(fspath);
+            return NULL;
+        }
+    }
+    if (!v4l2cam_acquire(self)) {
+        Py_XDECREF(fspath);
+        return NULL;
+    }
+    err = mc_cam_serve_mjpeg(&self->cam, fspath ? PyUnicode_AsUTF8(fspath) : NULL, port, slots);
+    Py_XDECREF(fspath);
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
+        v4l2cam_release(self);
+        return NULL;
+    }
+    mc_cam_serve_info(&self->cam, &info);
+    v4l2cam_release(self);
+    return PyLong_FromLong(info.port);
+}
 
-void *
-cam_read_worker(void *argp)
+PyObject *
+v4l2cam_serve_stop(v4l2camObject *self, PyObject *args)
 {
-    CamReadWorkerArgStruct *args = argp;
-    v4l2camObject *cam = args->cam;
-    uint8_t *dst = args->dst;
-    int libyuv_res;
-    
-    uint8_t argb[cam->height * cam->width * 4];
-    
-    //Prepare buffer
-    struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
-    //Dequeue buffer
-    if (-1 == v4l2_xioctl(cam->fd, VIDIOC_DQBUF, &buf)) {
-        fprintf(stderr, "ioctl(VIDIOC_DQBUF) failure : %d, %s", errno, strerror(errno));
-        args->res = 1;
+    if (!v4l2cam_acquire(self)) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    mc_cam_serve_stop(&self->cam);
+    Py_END_ALLOW_THREADS
+    v4l2cam_release(self);
+    Py_RETURN_NONE;
+}
+
+PyObject *
+v4l2cam_serve_info(v4l2camObject *self, PyObject *args)
+{
+    mc_stream_info info;
+    int err;
+    if (!v4l2cam_acquire(self)) return NULL;
+    err = mc_cam_serve_info(&self->cam, &info);
+    v4l2cam_release(self);
+    if (err == MC_ERR_STATE) Py_RETURN_NONE; //Not serving
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
         return NULL;
     }
-    
-    //Convert to ARGB
-    libyuv_res = ConvertToARGB(
-                   (uint8_t *) cam->buffers[buf.index].start, //sample
-                   cam->buffers[buf.index].length, //sample_size
-                   argb, cam->width*4, //dst, dst_stride
-                   0, 0, //crop_x, crop_y
-                   cam->width, cam->height,
-                   cam->width, cam->height,
-                   kRotate0, //RotationMode
-                   cam->fourcc); //FOURCC
-    
-    if (libyuv_res != 0) {
-        fprintf(stderr, "libyuv ConvertToARGB failed: %i\n", libyuv_res);
-        args->res = 2;
+    return Py_BuildValue("{s:i,s:i,s:K,s:K,s:K}", "port", info.port, "clients", info.clients,
+                         "frames", (unsigned long long) info.frames, "dropped", (unsigned long long) info.dropped,
+                         "sent", (unsigned long long) info.sent);
+}
+
+PyObject *
+v4l2cam_start(v4l2camObject *self, PyObject *args)
+{
+    int err;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
         return NULL;
     }
-    //Re-queue buffer
-    if (-1 == v4l2_xioctl(cam->fd, VIDIOC_QBUF, &buf)) {
-        fprintf(stderr, "v4l2 ioctl(VIDIOC_QBOF) failed:  %d, %s", errno, strerror(errno));
-        args->res = 3;
+    if (!v4l2cam_acquire(self)) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_cam_start(&self->cam);
+    Py_END_ALLOW_THREADS
+    v4l2cam_release(self);
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
         return NULL;
     }
-    //Convert to RGB, put in dst
-    libyuv_res = ARGBToRAW(argb, cam->width*4, dst, cam->width*3, cam->width, cam->height);
-    if (libyuv_res != 0) {
-        fprintf(stderr, "libyuv ARGBtoRAW failed: %i\n", libyuv_res);
-        args->res = 4;
+    Py_RETURN_NONE;
+}
+
+PyObject *
+v4l2cam_stop(v4l2camObject *self, PyObject *args)
+{
+    int err;
+    if (!self->cam.device) Py_RETURN_NONE;
+    if (!v4l2cam_acquire(self)) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_cam_stop(&self->cam);
+    Py_END_ALLOW_THREADS
+    v4l2cam_release(self);
+    if (err != MC_OK) {
+        mc_raise(&self->cam, err);
         return NULL;
     }
-    
-    args->res = 0;
-    return NULL;
+    Py_RETURN_NONE;
 }
 
 PyObject *
 v4l2cam_read(v4l2camObject *self)
 {
-    pthread_t thread;
-    CamReadWorkerArgStruct cam_args;
     PyObject *res;
-    uint8_t *dst = PyDataMem_NEW(self->width * self->height * 3);
+    int err;
+    if (!self->cam.device) {
+        PyErr_SetString(PyExc_RuntimeError, "v4l2cam has not been initialized");
+        return NULL;
+    }
+    if (!v4l2cam_acquire(self)) return NULL;
+    uint8_t *dst = PyDataMem_NEW(mc_cam_frame_size(&self->cam));
+    if (!dst) {
+        v4l2cam_release(self);
+        return PyErr_NoMemory();
+    }
     
-    //Prepare thread args
-    cam_args = (CamReadWorkerArgStruct){self, dst, 0};
-    //Run thread
-    pthread_create(&thread, NULL, cam_read_worker, (void *)(&cam_args));
-    pthread_join(thread, NULL);
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_cam_read(&self->cam, dst, NULL);
+    Py_END_ALLOW_THREADS
     //Check for errors
-    if (cam_args.res) {
-        PyErr_Format(PyExc_RuntimeError, "Reading image failed: %i\n", cam_args.res);
+    if (err != MC_OK) {
+        PyDataMem_FREE(dst);
+        PyErr_Format(PyExc_RuntimeError, "Reading image failed: %i (%s)\n", err, mc_cam_error(&self->cam));
+        v4l2cam_release(self);
         return NULL;
     }
+    v4l2cam_release(self);
     //To Numpy array
-    npy_intp dims[3] = {self->height, self->width, 3};
+    npy_intp dims[3] = {self->cam.height, self->cam.width, 3};
     res = PyArray_New(&PyArray_Type, 3, dims, NPY_UINT8, NULL, dst, 1, NPY_ARRAY_OWNDATA, NULL);
     if (!res) {
+        PyDataMem_FREE(dst);
         PyErr_SetString(PyExc_RuntimeError, "PyArray_NEW failed\n");
         return NULL;
     }
@@ -171,21 +328,49 @@ v4l2cam_read(v4l2camObject *self)
     return res;
 }
 
-static PyObject *
-camsys_read(PyObject *self, PyObject *args)
+static PyTypeObject v4l2camType;
+
+/* Cameras of a camsys, gathered for the native API */
+typedef struct CamsysCams {
+    int N;
+    int width;
+    int height;
+    mc_camera **cams;
+    PyObject **refs;
+    int nrefs;
+    int nbusy;          /* Cameras claimed with v4l2cam_acquire() (the first nbusy refs) */
+} CamsysCams;
+
+static void
+camsys_cams_release(CamsysCams *c)
 {
-    pthread_t *threads = NULL;
-    CamReadWorkerArgStruct *cam_args = NULL;
-    PyObject *res = NULL;
-    PyObject *camsys, *cams, *pywidth=NULL, *pyheight=NULL, *camobj, *cam=NULL;
-    if (!PyArg_ParseTuple(args, "OO", &camsys, &cams)) return NULL;
-        
-//    cams = PyObject_GetAttrString(camsys, "cameras"); //INCREF!
-    if (!cams) return NULL;
+    for (int i=0; i<c->nbusy; i++)
+        v4l2cam_release((v4l2camObject *) c->refs[i]);
+    for (int i=0; i<c->nrefs; i++)
+        Py_DECREF(c->refs[i]);
+    PyMem_Free(c->cams);
+    PyMem_Free(c->refs);
+    c->cams = NULL;
+    c->refs = NULL;
+    c->nrefs = 0;
+    c->nbusy = 0;
+}
+
+/*
+ * Collect and claim the v4l2cams of `cams`, checking they match the size of
+ * `camsys`. Returns 0 on error.
+ */
+static int
+camsys_cams_collect(PyObject *camsys, PyObject *cams, CamsysCams *c)
+{
+    PyObject *pywidth=NULL, *pyheight=NULL, *camobj, *cam=NULL;
+    int ok = 0;
 
-    int N = (int) PySequence_Length(cams);
-    if (N <= 0) {
-        PyErr_SetString(PyExc_ValueError, "camsys contains no cameras.");
+    memset(c, 0, sizeof(*c));
+    c->N = (int) PySequence_Length(cams);
+    if (c->N <= 0) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "camsys contains no cameras.");
         goto RETURN;
     }
 
@@ -193,44 +378,233 @@ camsys_read(PyObject *self, PyObject *args)
     if (!pywidth) goto RETURN;
     pyheight = PyObject_GetAttrString(camsys, "height"); //INCREF!
     if (!pyheight) goto RETURN;
-    int width = (int) PyLong_AsLong(pywidth);
-    int height = (int) PyLong_AsLong(pyheight);
-    int cam_dst_sz = width * height * 3;
+    c->width = (int) PyLong_AsLong(pywidth);
+    c->height = (int) PyLong_AsLong(pyheight);
+    if (PyErr_Occurred()) goto RETURN;
+
+    c->cams = (mc_camera **) PyMem_Malloc(c->N*sizeof(mc_camera *));
+    c->refs = (PyObject **) PyMem_Malloc(c->N*sizeof(PyObject *));
+    if (!c->cams || !c->refs) {
+        PyErr_NoMemory();
+        goto RETURN;
+    }
+
+    for (int i=0; i<c->N; i++) {
+        camobj = PySequence_GetItem(cams, i); //INCREF!
+        if (!camobj) goto RETURN;
+        cam = PyObject_GetAttrString(camobj, "_v4l2cam"); //INCREF!
+        Py_DECREF(camobj);
+        if (!cam) goto RETURN;
+        c->refs[c->nrefs++] = cam;
+        if (!PyObject_TypeCheck(cam, &v4l2camType)) {
+            PyErr_Format(PyExc_TypeError, "Camera %i has no v4l2cam.", i);
+            goto RETURN;
+        }
+        if (!v4l2cam_acquire((v4l2camObject *) cam)) goto RETURN; //Also rejects a camera listed twice
+        c->nbusy++;
+        c->cams[i] = &((v4l2camObject *) cam)->cam;
+        if (c->cams[i]->width != c->width || c->cams[i]->height != c->height) {
+            PyErr_Format(PyExc_ValueError, "Camera %i has size (%i,%i), expected (%i,%i).",
+                         i, c->cams[i]->width, c->cams[i]->height, c->width, c->height);
+            goto RETURN;
+        }
+    }
+    ok = 1;
 
+    RETURN:
+    if (!ok) camsys_cams_release(c);
+    Py_XDECREF(pywidth);
+    Py_XDECREF(pyheight);
+    return ok;
+}
 
-    threads = (pthread_t *) malloc(N*sizeof(pthread_t));
-    cam_args = (CamReadWorkerArgStruct *) malloc(N*sizeof(CamReadWorkerArgStruct));
+/* Capture times of a camsys read, in seconds on the clock of time.monotonic() */
+static PyObject *
+camsys_timestamps(const mc_frame_info *info, int n)
+{
+    npy_intp dims[1] = {n};
+    PyObject *ts = PyArray_SimpleNew(1, dims, NPY_FLOAT64); //INCREF!
+    if (!ts) return NULL;
+    double *t = (double *) PyArray_DATA((PyArrayObject *) ts);
+    for (int i=0; i<n; i++)
+        t[i] = info[i].timestamp_us * 1e-6;
+    return ts;
+}
+
+static PyObject *
+camsys_read(PyObject *self, PyObject *args)
+{
+    CamsysCams c;
+    PyObject *res = NULL, *arr = NULL, *ts = NULL;
+    PyObject *camsys, *cams;
+    mc_frame_info *info = NULL;
+    int err, failed, timestamps = 0;
+    if (!PyArg_ParseTuple(args, "OO|p", &camsys, &cams, &timestamps)) return NULL;
+    if (!camsys_cams_collect(camsys, cams, &c)) return NULL;
+    if (timestamps && !(info = (mc_frame_info *) PyMem_Malloc(c.N*sizeof(mc_frame_info)))) {
+        PyErr_NoMemory();
+        goto RETURN;
+    }
 
-    npy_intp dims[4] = {N,height, width, 3};
-    PyObject *arr = PyArray_SimpleNew(4, dims, NPY_UINT8); //INCREF!
+    //Left untouched: each camera's worker thread writes its frame first, which places it on the camera's NUMA node
+    npy_intp dims[4] = {c.N, c.height, c.width, 3};
+    arr = PyArray_SimpleNew(4, dims, NPY_UINT8); //INCREF!
     if (!arr)
         goto RETURN;
     uint8_t *dst = (uint8_t *) PyArray_DATA((PyArrayObject *) arr);
 
-    for (int i=0; i<N; i++) { //Prepare thread args
-        camobj = PySequence_GetItem(cams, i);
-        if (!camobj) goto RETURN;
-        cam = PyObject_GetAttrString(camobj, "_v4l2cam");
-        cam_args[i] = (CamReadWorkerArgStruct){(v4l2camObject *) cam, &dst[i * cam_dst_sz], 0};
-        Py_XDECREF(cam);
-    }
-    for (int i=0; i<N; i++) //Run threads
-        pthread_create(&(threads[i]), NULL, cam_read_worker, (void *)(&cam_args[i]));
-    for (int i=0; i<N; i++) 
-        pthread_join(threads[i], NULL);
-    for (int i=0; i<N; i++) { //Check for errors
-        if (cam_args[i].res) {
-            PyErr_Format(PyExc_RuntimeError, "Reading image from camera %i failed: %i\n", i, cam_args[i].res);
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_camsys_read(c.cams, c.N, dst, -1, info, &failed);
+    Py_END_ALLOW_THREADS
+    if (err != MC_OK) { //Check for errors
+        if (failed >= 0)
+            PyErr_Format(PyExc_RuntimeError, "Reading image from camera %i failed: %i (%s)\n", failed, err, mc_cam_error(c.cams[failed]));
+        else
+            PyErr_Format(PyExc_RuntimeError, "Reading images failed: %i (%s)\n", err, mc_strerror(err));
+        goto RETURN;
+    }
+
+    if (info) {
+        if (!(ts = camsys_timestamps(info, c.N))) goto RETURN;
+        res = Py_BuildValue("OO", arr, ts);
+    }
+    else {
+        res = arr;
+        arr = NULL;
+    }
+    RETURN:
+    camsys_cams_release(&c);
+    PyMem_Free(info);
+    Py_XDECREF(arr);
+    Py_XDECREF(ts);
+    return res;
+}
+
+/* Next (camera index, frame) from the multi-rate scheduler, in timestamp order */
+static PyObject *
+camsys_next(PyObject *self, PyObject *args)
+{
+    CamsysCams c;
+    PyObject *res = NULL, *arr = NULL;
+    PyObject *camsys, *cams;
+    int timeout_ms = -1, err, index;
+    if (!PyArg_ParseTuple(args, "OO|i", &camsys, &cams, &timeout_ms)) return NULL;
+    if (!camsys_cams_collect(camsys, cams, &c)) return NULL;
+
+    npy_intp dims[3] = {c.height, c.width, 3};
+    arr = PyArray_SimpleNew(3, dims, NPY_UINT8); //INCREF!
+    if (!arr)
+        goto RETURN;
+    uint8_t *dst = (uint8_t *) PyArray_DATA((PyArrayObject *) arr);
+
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_sched_next(c.cams, c.N, dst, timeout_ms, &index, NULL);
+    Py_END_ALLOW_THREADS
+    if (err == MC_ERR_TIMEOUT && index == -1) {
+        PyErr_Format(PyExc_TimeoutError, "No frame within %i ms", timeout_ms);
+        goto RETURN;
+    }
+    if (err != MC_OK) {
+        PyErr_Format(PyExc_RuntimeError, "Reading image from camera %i failed: %i (%s)\n", index, err, mc_cam_error(c.cams[index]));
+        goto RETURN;
+    }
+
+    res = Py_BuildValue("iO", index, arr);
+    RETURN:
+    camsys_cams_release(&c);
+    Py_XDECREF(arr);
+    return res;
+}
+
+static PyTypeObject mosaicType;
+
+/* Read all cameras of a camsys into their tiles of a mosaic */
+static PyObject *
+camsys_read_mosaic(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    CamsysCams c;
+    PyObject *res = NULL, *arr = NULL, *ts = NULL;
+    PyObject *camsys, *cams, *pymosaic, *pytiles = Py_None, *out = Py_None;
+    mc_frame_info *info = NULL;
+    int *tiles = NULL, err, failed, timestamps = 0;
+    static char *kwlist[] = {"camsys", "cams", "mosaic", "tiles", "out", "timestamps", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO!|OOp", kwlist,
+                                     &camsys, &cams, &mosaicType, &pymosaic, &pytiles, &out, &timestamps))
+        return NULL;
+    mc_mosaic *m = &((mosaicObject *) pymosaic)->m;
+    if (!camsys_cams_collect(camsys, cams, &c)) return NULL;
+    if (timestamps && !(info = (mc_frame_info *) PyMem_Malloc(c.N*sizeof(mc_frame_info)))) {
+        PyErr_NoMemory();
+        goto RETURN;
+    }
+
+    if (pytiles != Py_None) {
+        if (PySequence_Length(pytiles) != c.N) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "Need one tile per camera.");
             goto RETURN;
         }
+        tiles = (int *) PyMem_Malloc(c.N*sizeof(int));
+        if (!tiles) {
+            PyErr_NoMemory();
+            goto RETURN;
+        }
+        for (int i=0; i<c.N; i++) {
+            PyObject *t = PySequence_GetItem(pytiles, i); //INCREF!
+            if (!t) goto RETURN;
+            tiles[i] = (int) PyLong_AsLong(t);
+            Py_DECREF(t);
+            if (PyErr_Occurred()) goto RETURN;
+        }
+    }
+    else if (c.N > m->n) {
+        PyErr_Format(PyExc_ValueError, "Mosaic has %i tiles for %i cameras.", m->n, c.N);
+        goto RETURN;
     }
 
-    res = arr;
+    if (out == Py_None) {
+        npy_intp dims[3] = {m->height, m->width, 3};
+        arr = PyArray_ZEROS(3, dims, NPY_UINT8, 0); //INCREF!
+        if (!arr) goto RETURN;
+    }
+    else {
+        if (!PyArray_Check(out) || PyArray_TYPE((PyArrayObject *) out) != NPY_UINT8 ||
+            !PyArray_IS_C_CONTIGUOUS((PyArrayObject *) out) || !PyArray_ISWRITEABLE((PyArrayObject *) out) ||
+            PyArray_NDIM((PyArrayObject *) out) != 3 || PyArray_DIM((PyArrayObject *) out, 0) != m->height ||
+            PyArray_DIM((PyArrayObject *) out, 1) != m->width || PyArray_DIM((PyArrayObject *) out, 2) != 3) {
+            PyErr_Format(PyExc_ValueError, "out must be a writeable, C-contiguous uint8 array of shape (%i,%i,3).", m->height, m->width);
+            goto RETURN;
+        }
+        Py_INCREF(out);
+        arr = out;
+    }
+    uint8_t *dst = (uint8_t *) PyArray_DATA((PyArrayObject *) arr);
+
+    Py_BEGIN_ALLOW_THREADS
+    err = mc_camsys_read_mosaic(c.cams, tiles, c.N, m, dst, -1, info, &failed);
+    Py_END_ALLOW_THREADS
+    if (err != MC_OK) {
+        if (failed >= 0)
+            PyErr_Format(PyExc_RuntimeError, "Reading image from camera %i failed: %i (%s)\n", failed, err, mc_cam_error(c.cams[failed]));
+        else
+            PyErr_Format(PyExc_RuntimeError, "Reading images failed: %i (%s)\n", err, mc_strerror(err));
+        goto RETURN;
+    }
+
+    if (info) {
+        if (!(ts = camsys_timestamps(info, c.N))) goto RETURN;
+        res = Py_BuildValue("OO", arr, ts);
+    }
+    else {
+        res = arr;
+        arr = NULL;
+    }
     RETURN:
-    free(threads);
-    free(cam_args);
-    Py_XDECREF(pywidth);
-    Py_XDECREF(pyheight);
+    camsys_cams_release(&c);
+    PyMem_Free(tiles);
+    PyMem_Free(info);
+    Py_XDECREF(arr);
+    Py_XDECREF(ts);
     return res;
 }
 
@@ -238,15 +612,16 @@ static PyObject *
 is_valid_device(PyObject *module, PyObject *device)
 {
     PyObject *fspath = PyOS_FSPath(device);
-    char *devicestr = (char *) PyUnicode_AsUTF8(fspath);
-    int fd = open(devicestr, O_RDONLY, 0);
-    
-    int res = v4l2_test_valid_device(fd, devicestr);
-    close(fd);
-    if (res == 0) {
-        PyErr_Clear();
-        Py_RETURN_FALSE;
+    if (!fspath) return NULL;
+    if (!PyUnicode_Check(fspath)) {
+        PyErr_SetString(PyExc_TypeError, "device must be a str or path-like object");
+        Py_DECREF(fspath);
+        return NULL;
     }
+    int res = mc_is_valid_device(PyUnicode_AsUTF8(fspath));
+    Py_DECREF(fspath);
+    if (res == 0)
+        Py_RETURN_FALSE;
     else
         Py_RETURN_TRUE;
         
@@ -256,15 +631,24 @@ PyMethodDef v4l2cam_methods[] = {
     {"start",    (PyCFunction)v4l2cam_start,    METH_NOARGS, ""},
     {"stop",     (PyCFunction)v4l2cam_stop,     METH_NOARGS, ""},
     {"read",     (PyCFunction)v4l2cam_read,     METH_NOARGS, ""},
+    {"set_remap", (PyCFunction)v4l2cam_set_remap, METH_O,    ""},
+    {"set_affinity", (PyCFunction)v4l2cam_set_affinity, METH_O, ""},
+    {"set_realtime", (PyCFunction)v4l2cam_set_realtime, METH_O, ""},
+    {"serve",    (PyCFunction)v4l2cam_serve,    METH_VARARGS | METH_KEYWORDS, ""},
+    {"serve_stop", (PyCFunction)v4l2cam_serve_stop, METH_NOARGS, ""},
+    {"serve_info", (PyCFunction)v4l2cam_serve_info, METH_NOARGS, ""},
     {NULL, NULL, 0, NULL}
 };
 
 static PyMemberDef v4l2cam_members[] = {
-    {"device", T_OBJECT_EX, offsetof(v4l2camObject, device), 0, "device path"},
-    {"format", T_OBJECT_EX, offsetof(v4l2camObject, format), 0, "format specification"},
-    {"width", T_INT, offsetof(v4l2camObject, width), 0, "image width"},
-    {"height", T_INT, offsetof(v4l2camObject, height), 0, "image height"},
-    {"fd", T_INT, offsetof(v4l2camObject, fd), 0, "fd"},
+    {"device", T_OBJECT_EX, offsetof(v4l2camObject, device), READONLY, "device path"},
+    {"format", T_OBJECT_EX, offsetof(v4l2camObject, format), READONLY, "format specification"},
+    {"width", T_INT, offsetof(v4l2camObject, cam.width), READONLY, "image width"},
+    {"height", T_INT, offsetof(v4l2camObject, cam.height), READONLY, "image height"},
+    {"rate", T_FLOAT, offsetof(v4l2camObject, cam.rate), READONLY, "target output rate"},
+    {"fd", T_INT, offsetof(v4l2camObject, cam.fd), READONLY, "fd"},
+    {"numa_node", T_INT, offsetof(v4l2camObject, cam.numa_node), READONLY, "NUMA node of the CPU affinity, or -1"},
+    {"rt_priority", T_INT, offsetof(v4l2camObject, cam.rt_priority), READONLY, "SCHED_FIFO priority, or 0"},
     {NULL}  /* Sentinel */
 };
 
@@ -341,13 +725,24 @@ get_formats(PyObject *module, PyObject *device)
 
     PyObject *fmtdict = NULL, *details = NULL;
     char fourcc[] = "xxxx";
+    char errmsg[MC_ERRMSG_LEN];
 
     
-    PyObject *fspath = PyOS_FSPath(device);
+    PyObject *fspath = PyOS_FSPath(device); //INCREF!
+    if (!fspath) return NULL;
+    if (!PyUnicode_Check(fspath)) {
+        PyErr_SetString(PyExc_TypeError, "device must be a str or path-like object");
+        Py_DECREF(fspath);
+        return NULL;
+    }
     char *devicestr = (char *) PyUnicode_AsUTF8(fspath);
     int fd = open(devicestr, O_RDONLY, 0);
-    int valid = v4l2_test_valid_device(fd, devicestr);
-    if (!valid) goto return_err;
+    int valid = v4l2_test_valid_device(fd, devicestr, errmsg);
+    Py_DECREF(fspath);
+    if (!valid) {
+        PyErr_SetString(PyExc_SystemError, errmsg);
+        goto return_err;
+    }
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;   
     fmt.index = 0;
@@ -365,17 +760,218 @@ get_formats(PyObject *module, PyObject *device)
         PyDict_SetItemString(details, "framesizes", get_framesizes(fd, &fmt));
         PyDict_SetItemString(fmtdict, fourcc, details);
     }
-    if (!PyErr_Occurred())
+    if (!PyErr_Occurred()) {
+        close(fd);
         return fmtdict;
+    }
     
     
     return_err:
-    close(fd);
+    if (fd != -1) close(fd);
     Py_XDECREF(fmtdict);
     return NULL;    
 }
 
 
+static int
+mosaic_init(mosaicObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *pytiles, *pyoverlay = Py_None, *pymask = Py_None;
+    PyArrayObject *overlay = NULL, *mask = NULL;
+    mc_tile *tiles = NULL;
+    int width, height, n, err, res = -1;
+    static char *kwlist[] = {"size", "tiles", "overlay", "mask", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "(ii)O|OO", kwlist,
+                                     &width, &height, &pytiles, &pyoverlay, &pymask))
+        return -1;
+
+    n = (int) PySequence_Length(pytiles);
+    if (n <= 0) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "Mosaic needs at least one tile.");
+        return -1;
+    }
+    tiles = (mc_tile *) PyMem_Malloc(n*sizeof(mc_tile));
+    if (!tiles) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (int i=0; i<n; i++) {
+        PyObject *t = PySequence_GetItem(pytiles, i); //INCREF!
+        if (!t) goto RETURN;
+        int ok = PyArg_ParseTuple(t, "iiii;tiles must be (x, y, width, height)",
+                                  &tiles[i].x, &tiles[i].y, &tiles[i].width, &tiles[i].height);
+        Py_DECREF(t);
+        if (!ok) goto RETURN;
+    }
+
+    mc_mosaic_destroy(&self->m); //Re-initialization
+    if ((err = mc_mosaic_init(&self->m, width, height, n, tiles)) != MC_OK) {
+        if (err == MC_ERR_MEMORY) PyErr_NoMemory();
+        else PyErr_SetString(PyExc_ValueError, "Tiles must lie within the mosaic and not overlap.");
+        goto RETURN;
+    }
+
+    if ((pyoverlay == Py_None) != (pymask == Py_None)) {
+        PyErr_SetString(PyExc_ValueError, "overlay and mask must be given together.");
+        goto RETURN;
+    }
+    if (pyoverlay != Py_None) {
+        overlay = (PyArrayObject *) PyArray_FROMANY(pyoverlay, NPY_UINT8, 3, 3, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST); //INCREF!
+        mask = (PyArrayObject *) PyArray_FROMANY(pymask, NPY_UINT8, 2, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST); //INCREF!
+        if (!overlay || !mask) goto RETURN;
+        if (PyArray_DIM(overlay, 0) != height || PyArray_DIM(overlay, 1) != width || PyArray_DIM(overlay, 2) != 3 ||
+            PyArray_DIM(mask, 0) != height || PyArray_DIM(mask, 1) != width) {
+            PyErr_Format(PyExc_ValueError, "overlay must have shape (%i,%i,3) and mask (%i,%i).", height, width, height, width);
+            goto RETURN;
+        }
+        if (mc_mosaic_set_overlay(&self->m, PyArray_DATA(overlay), PyArray_DATA(mask)) != MC_OK) {
+            PyErr_NoMemory();
+            goto RETURN;
+        }
+    }
+    res = 0;
+
+    RETURN:
+    PyMem_Free(tiles);
+    Py_XDECREF(overlay);
+    Py_XDECREF(mask);
+    return res;
+}
+
+static void
+mosaic_dealloc(mosaicObject *self)
+{
+    mc_mosaic_destroy(&self->m);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMemberDef mosaic_members[] = {
+    {"width", T_INT, offsetof(mosaicObject, m.width), READONLY, "mosaic width"},
+    {"height", T_INT, offsetof(mosaicObject, m.height), READONLY, "mosaic height"},
+    {"n", T_INT, offsetof(mosaicObject, m.n), READONLY, "number of tiles"},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject mosaicType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "multicam.mosaic",
+    .tp_basicsize = sizeof(mosaicObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor) mosaic_dealloc,
+    .tp_members = mosaic_members,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc) mosaic_init,
+    .tp_new = PyType_GenericNew,
+};
+
+/* Float map of shape (height, width) as a C-contiguous float32 array */
+static PyArrayObject *
+float_map(PyObject *obj, int width, int height, const char *name)
+{
+    PyArrayObject *arr = (PyArrayObject *) PyArray_FROMANY(obj, NPY_FLOAT32, 2, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST); //INCREF!
+    if (arr && (PyArray_DIM(arr, 0) != height || PyArray_DIM(arr, 1) != width)) {
+        PyErr_Format(PyExc_ValueError, "%s must have shape (%i,%i).", name, height, width);
+        Py_CLEAR(arr);
+    }
+    return arr;
+}
+
+/* Matrix of `n` doubles, or NULL (without error) for None */
+static int
+double_matrix(PyObject *obj, int n, double *dst, const char *name)
+{
+    PyArrayObject *arr;
+    if (obj == Py_None) return 0;
+    arr = (PyArrayObject *) PyArray_FROMANY(obj, NPY_FLOAT64, 1, 2, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST); //INCREF!
+    if (!arr) return -1;
+    if (PyArray_SIZE(arr) > n || (n == 9 && PyArray_SIZE(arr) != 9) || PyArray_SIZE(arr) < 4) {
+        PyErr_Format(PyExc_ValueError, "%s has the wrong size.", name);
+        Py_DECREF(arr);
+        return -1;
+    }
+    memset(dst, 0, n * sizeof(double));
+    memcpy(dst, PyArray_DATA(arr), PyArray_SIZE(arr) * sizeof(double));
+    Py_DECREF(arr);
+    return 1;
+}
+
+static int
+remap_init(remapObject *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *pymapx = Py_None, *pymapy = Py_None, *pyK = Py_None, *pyD = Py_None, *pyR = Py_None, *pyP = Py_None;
+    PyArrayObject *mapx = NULL, *mapy = NULL;
+    double K[9], D[5], R[9], P[9];
+    int width, height, err, hasR, hasP, res = -1;
+    static char *kwlist[] = {"size", "mapx", "mapy", "K", "D", "R", "P", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "(ii)|OOOOOO", kwlist, &width, &height,
+                                     &pymapx, &pymapy, &pyK, &pyD, &pyR, &pyP))
+        return -1;
+
+    mc_remap_destroy(&self->r); //Re-initialization
+    if (pymapx != Py_None && pymapy != Py_None) {
+        mapx = float_map(pymapx, width, height, "mapx");
+        if (!mapx) goto RETURN;
+        mapy = float_map(pymapy, width, height, "mapy");
+        if (!mapy) goto RETURN;
+        Py_BEGIN_ALLOW_THREADS
+        //Cameras only take remaps of their own size (see mc_cam_set_remap())
+        err = mc_remap_init_maps(&self->r, width, height, width, height, PyArray_DATA(mapx), PyArray_DATA(mapy));
+        Py_END_ALLOW_THREADS
+    }
+    else if (pyK != Py_None && pyD != Py_None) {
+        if (double_matrix(pyK, 9, K, "K") < 0 || double_matrix(pyD, 5, D, "D") < 0 ||
+            (hasR = double_matrix(pyR, 9, R, "R")) < 0 || (hasP = double_matrix(pyP, 9, P, "P")) < 0)
+            goto RETURN;
+        Py_BEGIN_ALLOW_THREADS
+        err = mc_remap_init_calib(&self->r, width, height, K, D, hasR ? R : NULL, hasP ? P : NULL);
+        Py_END_ALLOW_THREADS
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError, "Need either mapx and mapy, or K and D.");
+        goto RETURN;
+    }
+    if (err == MC_ERR_MEMORY) {
+        PyErr_NoMemory();
+        goto RETURN;
+    }
+    if (err != MC_OK) {
+        PyErr_SetString(PyExc_ValueError, "Invalid remap parameters.");
+        goto RETURN;
+    }
+    res = 0;
+
+    RETURN:
+    Py_XDECREF(mapx);
+    Py_XDECREF(mapy);
+    return res;
+}
+
+static void
+remap_dealloc(remapObject *self)
+{
+    mc_remap_destroy(&self->r);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMemberDef remap_members[] = {
+    {"width", T_INT, offsetof(remapObject, r.width), READONLY, "output width"},
+    {"height", T_INT, offsetof(remapObject, r.height), READONLY, "output height"},
+    {NULL}  /* Sentinel */
+};
+
+static PyTypeObject remapType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "multicam.remap",
+    .tp_basicsize = sizeof(remapObject),
+    .tp_itemsize = 0,
+    .tp_dealloc = (destructor) remap_dealloc,
+    .tp_members = remap_members,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc) remap_init,
+    .tp_new = PyType_GenericNew,
+};
+
 static PyTypeObject v4l2camType = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "multicam.v4l2cam",
@@ -391,6 +987,8 @@ static PyTypeObject v4l2camType = {
 
 static PyMethodDef v4l2camMethods[] = {
     {"camsys_read",     (PyCFunction)camsys_read,     METH_VARARGS, NULL},
+    {"camsys_next",     (PyCFunction)camsys_next,     METH_VARARGS, NULL},
+    {"camsys_read_mosaic", (PyCFunction)camsys_read_mosaic, METH_VARARGS | METH_KEYWORDS, NULL},
     {"is_valid_device", (PyCFunction)is_valid_device, METH_O,       NULL},
     {"get_formats",     (PyCFunction)get_formats,     METH_O,       NULL},
     {NULL, NULL, 0, NULL}        /* Sentinel */
@@ -412,6 +1010,10 @@ PyInit_backend(void)
     PyObject *m;
     if (PyType_Ready(&v4l2camType) < 0)
         return NULL;
+    if (PyType_Ready(&mosaicType) < 0)
+        return NULL;
+    if (PyType_Ready(&remapType) < 0)
+        return NULL;
 
     m = PyModule_Create(&multicammodule);
     if (m == NULL)
@@ -423,6 +1025,18 @@ PyInit_backend(void)
         Py_DECREF(m);
         return NULL;
     }
+    Py_INCREF(&mosaicType);
+    if (PyModule_AddObject(m, "mosaic", (PyObject *) &mosaicType) < 0) {
+        Py_DECREF(&mosaicType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&remapType);
+    if (PyModule_AddObject(m, "remap", (PyObject *) &remapType) < 0) {
+        Py_DECREF(&remapType);
+        Py_DECREF(m);
+        return NULL;
+    }
 
     return m;
 }
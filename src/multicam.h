@@ -1,22 +1,27 @@
 #ifndef MULTICAM_H
 #define MULTICAM_H
-struct buffer {
-    void * start;
-    size_t length;
-};
+#include "libmulticam.h"
 
+/* Python wrapper around a libmulticam camera */
 typedef struct v4l2camObject {
     PyObject_HEAD
-//    PyObject *device;
-    char* device;
-    char* format;
-    struct buffer* buffers;
-    unsigned int n_buffers;
-    int width;
-    int height;
-    float fps;
-    int fd;
-    int fourcc;
+    PyObject *device;
+    PyObject *format;
+    PyObject *remap;
+    int busy;                   /* A method is using `cam` (possibly without the GIL) */
+    mc_camera cam;
 } v4l2camObject;
 
+/* Python wrapper around a libmulticam mosaic layout */
+typedef struct mosaicObject {
+    PyObject_HEAD
+    mc_mosaic m;
+} mosaicObject;
+
+/* Python wrapper around a libmulticam remap table */
+typedef struct remapObject {
+    PyObject_HEAD
+    mc_remap r;
+} remapObject;
+
 #endif //MULTICAM_H
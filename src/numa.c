@@ -0,0 +1,78 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa.h"
+
+/*
+ * NUMA placement without libnuma: node lookup through sysfs and memory
+ * policies through the mbind system call. Failures only lose the placement.
+ * Prefixed mcnuma_ so the library links together with libnuma.
+ */
+
+/* NUMA node of a CPU, or -1 if unknown */
+static int
+mcnuma_node_of_cpu(int cpu)
+{
+    char path[64];
+    struct dirent *e;
+    DIR *d;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if (!(d = opendir(path))) return -1;
+    while ((e = readdir(d))) {
+        if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+            node = atoi(&e->d_name[4]);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+/* Common NUMA node of `cpus`, or -1 if they span several nodes or it is unknown */
+int
+mcnuma_node_of_cpus(const int *cpus, int n)
+{
+    int node = -1;
+    for (int i=0; i<n; i++) {
+        int c = mcnuma_node_of_cpu(cpus[i]);
+        if (c < 0 || (i > 0 && c != node)) return -1;
+        node = c;
+    }
+    return node;
+}
+
+/* Prefer `node` for the pages of [p, p+size), which must be page aligned at `p` */
+void
+mcnuma_bind(void *p, size_t size, int node)
+{
+    const int bits = 8 * (int) sizeof(unsigned long);
+
+    if (node < 0 || !size) return;
+    unsigned long mask[node / bits + 1];
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] = 1UL << (node % bits);
+    syscall(SYS_mbind, p, size, MPOL_PREFERRED, mask, (unsigned long) node + 2, 0);
+}
+
+/* Page aligned allocation, placed on `node` when first touched (-1: no preference) */
+void *
+mcnuma_alloc(size_t size, int node)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    mcnuma_bind(p, size, node);
+    return p;
+}
+
+void
+mcnuma_free(void *p, size_t size)
+{
+    if (p) munmap(p, size);
+}
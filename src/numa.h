@@ -0,0 +1,8 @@
+#ifndef MCNUMA_H
+#define MCNUMA_H
+#include <stddef.h>
+int mcnuma_node_of_cpus(const int *cpus, int n);
+void *mcnuma_alloc(size_t size, int node);
+void mcnuma_bind(void *p, size_t size, int node);
+void mcnuma_free(void *p, size_t size);
+#endif //MCNUMA_H
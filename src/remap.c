@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "libmulticam.h"
+#include "remap.h"
+
+/*
+ * Undistortion/rectification remap tables and the ARGB interpolation kernel.
+ */
+int
+mc_remap_init_maps(mc_remap *r, int src_width, int src_height, int width, int height,
+                   const float *mapx, const float *mapy)
+{
+    const int one = 1 << MC_REMAP_BITS;
+    const float scale = (float) (1 << (MC_REMAP_BITS / 2));
+    size_t npix = (size_t) width * height, i = 0;
+
+    memset(r, 0, sizeof(*r));
+    if (src_width < 2 || src_height < 2 || width <= 0 || height <= 0 || !mapx || !mapy)
+        return MC_ERR_ARG;
+    r->offset = malloc(npix * sizeof(int32_t));
+    r->weights = malloc(npix * 4 * sizeof(int16_t));
+    if (!r->offset || !r->weights) {
+        mc_remap_destroy(r);
+        return MC_ERR_MEMORY;
+    }
+    r->src_width = src_width;
+    r->src_height = src_height;
+    r->width = width;
+    r->height = height;
+
+    //Store entries tile by tile, in the order remap_argb() visits them
+    for (int ty=0; ty<height; ty+=MC_REMAP_TILE)
+    for (int tx=0; tx<width; tx+=MC_REMAP_TILE)
+    for (int y=ty; y<ty+MC_REMAP_TILE && y<height; y++)
+    for (int x=tx; x<tx+MC_REMAP_TILE && x<width; x++, i++) {
+        float sx = mapx[(size_t) y * width + x], sy = mapy[(size_t) y * width + x];
+        int16_t *w = &r->weights[4*i];
+
+        if (!(sx >= 0 && sy >= 0 && sx <= src_width - 1 && sy <= src_height - 1)) { //Also catches NaN
+            r->offset[i] = 0;
+            w[0] = w[1] = w[2] = w[3] = 0;
+            continue;
+        }
+        int x0 = (int) sx, y0 = (int) sy;
+        int fx = (int) lrintf((sx - x0) * scale), fy = (int) lrintf((sy - y0) * scale);
+        //Keep the 2x2 neighbourhood inside the source
+        if (x0 > src_width - 2) { x0 = src_width - 2; fx = (int) scale; }
+        if (y0 > src_height - 2) { y0 = src_height - 2; fy = (int) scale; }
+        r->offset[i] = y0 * src_width + x0;
+        w[0] = (int16_t) (((int) scale - fx) * ((int) scale - fy));
+        w[1] = (int16_t) (fx * ((int) scale - fy));
+        w[2] = (int16_t) (((int) scale - fx) * fy);
+        w[3] = (int16_t) (one - w[0] - w[1] - w[2]);
+    }
+    return MC_OK;
+}
+
+/* Inverse of a 3x3 row major matrix; returns 0 if singular */
+static int
+mat3_inv(const double *m, double *inv)
+{
+    double det = m[0]*(m[4]*m[8] - m[5]*m[7]) - m[1]*(m[3]*m[8] - m[5]*m[6]) + m[2]*(m[3]*m[7] - m[4]*m[6]);
+    if (fabs(det) < 1e-12) return 0;
+    inv[0] =  (m[4]*m[8] - m[5]*m[7]) / det;
+    inv[1] = -(m[1]*m[8] - m[2]*m[7]) / det;
+    inv[2] =  (m[1]*m[5] - m[2]*m[4]) / det;
+    inv[3] = -(m[3]*m[8] - m[5]*m[6]) / det;
+    inv[4] =  (m[0]*m[8] - m[2]*m[6]) / det;
+    inv[5] = -(m[0]*m[5] - m[2]*m[3]) / det;
+    inv[6] =  (m[3]*m[7] - m[4]*m[6]) / det;
+    inv[7] = -(m[0]*m[7] - m[1]*m[6]) / det;
+    inv[8] =  (m[0]*m[4] - m[1]*m[3]) / det;
+    return 1;
+}
+
+int
+mc_remap_init_calib(mc_remap *r, int width, int height, const double *K, const double *D,
+                    const double *R, const double *P)
+{
+    static const double I[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    double PR[9], iPR[9];
+    float *mapx, *mapy;
+    int res;
+
+    memset(r, 0, sizeof(*r));
+    if (!K || !D || width <= 0 || height <= 0) return MC_ERR_ARG;
+    if (!R) R = I;
+    if (!P) P = K;
+    for (int i=0; i<3; i++)
+        for (int j=0; j<3; j++)
+            PR[3*i + j] = P[3*i]*R[j] + P[3*i + 1]*R[3 + j] + P[3*i + 2]*R[6 + j];
+    if (!mat3_inv(PR, iPR)) return MC_ERR_ARG;
+
+    mapx = malloc((size_t) width * height * sizeof(float));
+    mapy = malloc((size_t) width * height * sizeof(float));
+    if (!mapx || !mapy) {
+        free(mapx);
+        free(mapy);
+        return MC_ERR_MEMORY;
+    }
+
+    //Plumb bob model, as OpenCV initUndistortRectifyMap
+    for (int v=0; v<height; v++) {
+        for (int u=0; u<width; u++) {
+            double X = iPR[0]*u + iPR[1]*v + iPR[2];
+            double Y = iPR[3]*u + iPR[4]*v + iPR[5];
+            double W = iPR[6]*u + iPR[7]*v + iPR[8];
+            double x = X / W, y = Y / W;
+            double r2 = x*x + y*y;
+            double kr = 1 + ((D[4]*r2 + D[1])*r2 + D[0])*r2;
+            double xd = x*kr + 2*D[2]*x*y + D[3]*(r2 + 2*x*x);
+            double yd = y*kr + D[2]*(r2 + 2*y*y) + 2*D[3]*x*y;
+            mapx[(size_t) v * width + u] = (float) (K[0]*xd + K[1]*yd + K[2]);
+            mapy[(size_t) v * width + u] = (float) (K[4]*yd + K[5]);
+        }
+    }
+    res = mc_remap_init_maps(r, width, height, width, height, mapx, mapy);
+    free(mapx);
+    free(mapy);
+    return res;
+}
+
+void
+mc_remap_destroy(mc_remap *r)
+{
+    free(r->offset);
+    free(r->weights);
+    memset(r, 0, sizeof(*r));
+}
+
+/* Bilinear interpolation of one ARGB pixel from the 2x2 neighbourhood at `p`, as B | G<<8 | R<<16 | A<<24 */
+static inline uint32_t
+remap_pixel(const uint8_t *p, int stride, const int16_t *w)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i wv = _mm_loadl_epi64((const __m128i *) w);
+    __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p), zero);
+    __m128i bot = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (p + stride)), zero);
+    //Interleave left/right neighbours per channel, so madd weighs and sums each pair
+    top = _mm_unpacklo_epi16(top, _mm_srli_si128(top, 8));
+    bot = _mm_unpacklo_epi16(bot, _mm_srli_si128(bot, 8));
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(top, _mm_shuffle_epi32(wv, 0x00)),
+                                _mm_madd_epi16(bot, _mm_shuffle_epi32(wv, 0x55)));
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (MC_REMAP_BITS - 1))), MC_REMAP_BITS);
+    sum = _mm_packs_epi32(sum, sum);
+    sum = _mm_packus_epi16(sum, sum);
+    return (uint32_t) _mm_cvtsi128_si32(sum);
+#else
+    uint32_t px = 0;
+    for (int c=0; c<4; c++)
+        px |= (uint32_t) ((p[c]*w[0] + p[4 + c]*w[1] + p[stride + c]*w[2] + p[stride + 4 + c]*w[3]
+                           + (1 << (MC_REMAP_BITS - 1))) >> MC_REMAP_BITS) << (8*c);
+    return px;
+#endif
+}
+
+/*
+ * Remap a packed ARGB source of the remap's source size into `dst`, with
+ * `bpp` 4 for ARGB or 3 for packed RGB (libyuv RAW). Inlined with a constant
+ * `bpp`, so each output has its own loop.
+ */
+static inline void
+remap_run(const mc_remap *r, const uint8_t *src, uint8_t *dst, int dst_stride, int bpp)
+{
+    const int src_stride = r->src_width * 4;
+    size_t i = 0;
+
+    for (int ty=0; ty<r->height; ty+=MC_REMAP_TILE)
+    for (int tx=0; tx<r->width; tx+=MC_REMAP_TILE) {
+        int y1 = (ty + MC_REMAP_TILE < r->height) ? ty + MC_REMAP_TILE : r->height;
+        int x1 = (tx + MC_REMAP_TILE < r->width) ? tx + MC_REMAP_TILE : r->width;
+        for (int y=ty; y<y1; y++) {
+            uint8_t *d = &dst[(size_t) y * dst_stride + (size_t) tx * bpp];
+            for (int x=tx; x<x1; x++, i++, d+=bpp) {
+                uint32_t px = remap_pixel(&src[(size_t) r->offset[i] * 4], src_stride, &r->weights[4*i]);
+                if (bpp == 4) {
+                    d[0] = (uint8_t) px;
+                    d[1] = (uint8_t) (px >> 8);
+                    d[2] = (uint8_t) (px >> 16);
+                    d[3] = (uint8_t) (px >> 24);
+                }
+                else {
+                    d[0] = (uint8_t) (px >> 16);
+                    d[1] = (uint8_t) (px >> 8);
+                    d[2] = (uint8_t) px;
+                }
+            }
+        }
+    }
+}
+
+void
+remap_argb(const mc_remap *r, const uint8_t *src, uint8_t *dst, int dst_stride)
+{
+    remap_run(r, src, dst, dst_stride, 4);
+}
+
+void
+remap_argb_to_raw(const mc_remap *r, const uint8_t *src, uint8_t *dst, int dst_stride)
+{
+    remap_run(r, src, dst, dst_stride, 3);
+}
@@ -0,0 +1,7 @@
+#ifndef REMAP_H
+#define REMAP_H
+#include "libmulticam.h"
+/* Remap packed ARGB of the remap's source size into ARGB, or straight into packed RGB (RAW) */
+void remap_argb(const mc_remap *r, const uint8_t *src, uint8_t *dst, int dst_stride);
+void remap_argb_to_raw(const mc_remap *r, const uint8_t *src, uint8_t *dst, int dst_stride);
+#endif //REMAP_H
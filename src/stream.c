@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "libmulticam.h"
+#include "v4l2.h"
+#include "stream.h"
+
+/*
+ * MJPEG over HTTP (multipart/x-mixed-replace). Payloads are sent as captured;
+ * a client that falls behind skips to the latest frame when its current one
+ * has been written, so slow clients never hold back capture or other clients.
+ */
+#define STREAM_BOUNDARY "mcframe"
+#define STREAM_REQUEST_MAX 2048
+#define STREAM_EVENTS 64
+
+static const char STREAM_RESPONSE[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=" STREAM_BOUNDARY "\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Pragma: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char STREAM_BAD_METHOD[] =
+    "HTTP/1.0 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+struct StreamClient {
+    int fd;
+    int index;                  /* In mc_stream.clients */
+    int closed;                 /* Freed after the current batch of events */
+    StreamClient *next_closed;
+    int active;                 /* Request received; frames are sent */
+    int closing;                /* Close once the header is written */
+    int want_out;               /* EPOLLOUT is armed */
+    char request[STREAM_REQUEST_MAX];
+    size_t request_len;
+    char header[192];           /* HTTP response or part header */
+    size_t header_len;
+    StreamSlot *slot;           /* Frame being sent, or NULL */
+    size_t sent;                /* Bytes of header + frame + trailer written */
+    uint64_t last_seq;
+};
+
+/* Markers for the epoll entries that are not clients */
+static char LISTEN_TAG, EVENT_TAG;
+
+/*
+ * Ring
+ */
+
+/* A slot the producer may overwrite: not being sent and not the latest frame */
+StreamSlot *
+stream_free_slot(mc_stream *s)
+{
+    int latest = atomic_load(&s->latest);
+    for (int k=0; k<s->n_slots; k++) {
+        int i = (s->next + k) % s->n_slots;
+        if (i != latest && atomic_load(&s->slots[i].refs) == 0) {
+            s->next = (i + 1) % s->n_slots;
+            return &s->slots[i];
+        }
+    }
+    atomic_fetch_add(&s->stat_dropped, 1);
+    return NULL;
+}
+
+void
+stream_publish(mc_stream *s, StreamSlot *slot)
+{
+    uint64_t one = 1;
+    slot->seq = ++s->seq;
+    atomic_store(&s->latest, (int) (slot - s->slots));
+    atomic_fetch_add(&s->stat_frames, 1);
+    if (write(s->event_fd, &one, sizeof(one)) < 0) {} //Counter overflow is harmless
+}
+
+/* Reference the latest slot if it is newer than `seq`, or return NULL */
+static StreamSlot *
+stream_acquire(mc_stream *s, uint64_t seq)
+{
+    for (;;) {
+        int i = atomic_load(&s->latest);
+        if (i < 0) return NULL;
+        atomic_fetch_add(&s->slots[i].refs, 1);
+        if (atomic_load(&s->latest) == i) { //Not reused in between
+            if (s->slots[i].seq > seq) return &s->slots[i];
+            atomic_fetch_sub(&s->slots[i].refs, 1);
+            return NULL;
+        }
+        atomic_fetch_sub(&s->slots[i].refs, 1);
+    }
+}
+
+/*
+ * Clients
+ */
+static void
+client_close(mc_stream *s, StreamClient *c)
+{
+    if (c->slot) atomic_fetch_sub(&c->slot->refs, 1);
+    c->slot = NULL;
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    s->clients[c->index] = s->clients[--s->n_clients];
+    s->clients[c->index]->index = c->index;
+    if (c->active) atomic_fetch_sub(&s->stat_clients, 1);
+    //Pending events may still point to the client
+    c->closed = 1;
+    c->next_closed = s->closed;
+    s->closed = c;
+}
+
+static int
+client_want_out(mc_stream *s, StreamClient *c, int on)
+{
+    struct epoll_event ev = {EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0), {.ptr = c}};
+    if (c->want_out == on) return 0;
+    c->want_out = on;
+    return epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Start sending the latest frame, if there is a new one */
+static void
+client_next(mc_stream *s, StreamClient *c)
+{
+    StreamSlot *slot = stream_acquire(s, c->last_seq);
+    if (!slot) return;
+    c->slot = slot;
+    c->sent = 0;
+    c->header_len = (size_t) snprintf(c->header, sizeof(c->header),
+                                      "--" STREAM_BOUNDARY "\r\n"
+                                      "Content-Type: image/jpeg\r\n"
+                                      "Content-Length: %zu\r\n"
+                                      "X-Timestamp-Us: %llu\r\n"
+                                      "\r\n",
+                                      slot->size, (unsigned long long) slot->info.timestamp_us);
+}
+
+/*
+ * Write as much of the pending header and frame as the socket takes. Returns
+ * -1 if the client is gone (and closed).
+ */
+static int
+client_flush(mc_stream *s, StreamClient *c)
+{
+    for (;;) {
+        size_t frame = c->slot ? c->slot->size : 0;
+        size_t total = c->header_len + frame + (c->slot ? 2 : 0);
+        struct iovec iov[3];
+        struct msghdr msg;
+        int n = 0;
+        ssize_t r;
+
+        if (c->sent == total) { //Done; move on to the latest frame
+            if (c->slot) {
+                c->last_seq = c->slot->seq;
+                atomic_fetch_sub(&c->slot->refs, 1);
+                atomic_fetch_add(&s->stat_sent, 1);
+                c->slot = NULL;
+            }
+            c->header_len = c->sent = 0;
+            if (c->closing) {
+                client_close(s, c);
+                return -1;
+            }
+            client_next(s, c);
+            if (!c->slot) break;
+            continue;
+        }
+        //Gather what is left of header, payload and trailer
+        size_t off = c->sent;
+        if (off < c->header_len) {
+            iov[n++] = (struct iovec){c->header + off, c->header_len - off};
+            off = 0;
+        }
+        else
+            off -= c->header_len;
+        if (c->slot) {
+            if (off < frame) {
+                iov[n++] = (struct iovec){c->slot->data + off, frame - off};
+                off = 0;
+            }
+            else
+                off -= frame;
+            iov[n++] = (struct iovec){(char *) "\r\n" + off, 2 - off};
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        r = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (client_want_out(s, c, 1) == 0) return 0;
+            }
+            client_close(s, c);
+            return -1;
+        }
+        c->sent += (size_t) r;
+    }
+    if (client_want_out(s, c, 0) != 0) {
+        client_close(s, c);
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the HTTP request (and ignore anything after it) */
+static void
+client_read(mc_stream *s, StreamClient *c)
+{
+    char drain[512];
+    ssize_t r;
+
+    for (;;) {
+        int done = c->active || c->closing;
+        char *buf = done ? drain : c->request + c->request_len;
+        size_t len = done ? sizeof(drain) : sizeof(c->request) - 1 - c->request_len;
+        r = recv(c->fd, buf, len, MSG_DONTWAIT);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (r <= 0) { //Closed or failed
+            client_close(s, c);
+            return;
+        }
+        if (done) continue;
+        c->request_len += (size_t) r;
+        c->request[c->request_len] = 0;
+        if (!strstr(c->request, "\r\n\r\n") && !strstr(c->request, "\n\n") &&
+            c->request_len < sizeof(c->request) - 1)
+            continue;
+        //Any GET serves the stream
+        if (strncmp(c->request, "GET ", 4) != 0) {
+            memcpy(c->header, STREAM_BAD_METHOD, sizeof(STREAM_BAD_METHOD) - 1);
+            c->header_len = sizeof(STREAM_BAD_METHOD) - 1;
+            c->closing = 1;
+        }
+        else {
+            memcpy(c->header, STREAM_RESPONSE, sizeof(STREAM_RESPONSE) - 1);
+            c->header_len = sizeof(STREAM_RESPONSE) - 1;
+            c->active = 1;
+            atomic_fetch_add(&s->stat_clients, 1);
+        }
+        c->sent = 0;
+        if (client_flush(s, c) < 0) return;
+    }
+}
+
+static void
+server_accept(mc_stream *s)
+{
+    for (;;) {
+        struct epoll_event ev;
+        StreamClient *c;
+        int fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; //EAGAIN, or out of descriptors until a client leaves
+        }
+        if (s->n_clients == s->cap_clients) {
+            int cap = s->cap_clients ? 2 * s->cap_clients : 16;
+            StreamClient **p = realloc(s->clients, cap * sizeof(StreamClient *));
+            if (!p) {
+                close(fd);
+                continue;
+            }
+            s->clients = p;
+            s->cap_clients = cap;
+        }
+        if (!(c = calloc(1, sizeof(StreamClient)))) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->index = s->n_clients;
+        ev = (struct epoll_event){EPOLLIN | EPOLLRDHUP, {.ptr = c}};
+        if (epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        s->clients[s->n_clients++] = c;
+    }
+}
+
+static void
+stream_free_closed(mc_stream *s)
+{
+    while (s->closed) {
+        StreamClient *c = s->closed;
+        s->closed = c->next_closed;
+        free(c);
+    }
+}
+
+static void *
+server_worker(void *arg)
+{
+    mc_stream *s = arg;
+    struct epoll_event events[STREAM_EVENTS];
+    uint64_t count;
+
+    while (!atomic_load(&s->stop)) {
+        int n = epoll_wait(s->epoll_fd, events, STREAM_EVENTS, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int i=0; i<n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &LISTEN_TAG)
+                server_accept(s);
+            else if (tag == &EVENT_TAG) { //New frame: start it on every idle client
+                if (read(s->event_fd, &count, sizeof(count)) < 0) {}
+                for (int j=s->n_clients-1; j>=0; j--) {
+                    StreamClient *c = s->clients[j];
+                    if (c->active && !c->slot && !c->header_len) {
+                        client_next(s, c);
+                        if (c->slot) client_flush(s, c);
+                    }
+                }
+            }
+            else {
+                StreamClient *c = tag;
+                if (c->closed) continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    client_close(s, c);
+                    continue;
+                }
+                if ((events[i].events & EPOLLOUT) && client_flush(s, c) < 0) continue;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) client_read(s, c);
+            }
+        }
+        stream_free_closed(s);
+    }
+    while (s->n_clients) client_close(s, s->clients[s->n_clients - 1]);
+    stream_free_closed(s);
+    return NULL;
+}
+
+/*
+ * Setup
+ */
+
+/* Is a server listening on the Unix socket `addr`? A full backlog (EAGAIN) also means it is alive. */
+static int
+unix_socket_live(const struct sockaddr_un *addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), live;
+    if (fd < 0) return 0;
+    live = (connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) == 0 || errno == EAGAIN);
+    close(fd);
+    return live;
+}
+
+static int
+stream_listen(mc_stream *s, const char *address, int port)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int one = 1, fd;
+
+    memset(&addr, 0, sizeof(addr));
+    if (address && address[0] == '/') { //Unix domain socket
+        struct sockaddr_un *un = (struct sockaddr_un *) &addr;
+        struct stat st;
+        if (strlen(address) >= sizeof(un->sun_path)) {
+            mc_seterr(s->cam, MC_ERR_ARG, "Socket path too long: %s", address);
+            return MC_ERR_ARG;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address);
+        len = sizeof(*un);
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            if (unix_socket_live(un)) {
+                mc_seterr(s->cam, MC_ERR_STREAM, "Cannot listen on %s : Another server is listening", address);
+                return MC_ERR_STREAM;
+            }
+            unlink(address); //Stale socket
+        }
+    }
+    else {
+        struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &addr;
+        if (!address) address = "127.0.0.1";
+        if (port < 0 || port > 65535) {
+            mc_seterr(s->cam, MC_ERR_ARG, "Invalid port %d", port);
+            return MC_ERR_ARG;
+        }
+        if (inet_pton(AF_INET, address, &in->sin_addr) == 1) {
+            in->sin_family = AF_INET;
+            in->sin_port = htons(port);
+            len = sizeof(*in);
+        }
+        else if (inet_pton(AF_INET6, address, &in6->sin6_addr) == 1) {
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            len = sizeof(*in6);
+        }
+        else {
+            mc_seterr(s->cam, MC_ERR_ARG, "Invalid address '%s'", address);
+            return MC_ERR_ARG;
+        }
+    }
+
+    fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        mc_seterr(s->cam, MC_ERR_STREAM, "socket failure : %d, %s", errno, strerror(errno));
+        return MC_ERR_STREAM;
+    }
+    if (addr.ss_family != AF_UNIX) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *) &addr, len) != 0 || listen(fd, 64) != 0) {
+        if (addr.ss_family == AF_UNIX)
+            mc_seterr(s->cam, MC_ERR_STREAM, "Cannot listen on %s : %d, %s", address, errno, strerror(errno));
+        else
+            mc_seterr(s->cam, MC_ERR_STREAM, "Cannot listen on %s:%d : %d, %s", address, port, errno, strerror(errno));
+        close(fd);
+        return MC_ERR_STREAM;
+    }
+    s->listen_fd = fd;
+    if (addr.ss_family == AF_UNIX) { //Removed again by stream_destroy()
+        if (!(s->unix_path = strdup(address))) {
+            unlink(address);
+            mc_seterr(s->cam, MC_ERR_MEMORY, "Out of memory");
+            return MC_ERR_MEMORY;
+        }
+    }
+    else { //Actual port, if 0 was asked for
+        len = sizeof(addr);
+        getsockname(fd, (struct sockaddr *) &addr, &len);
+        s->port = ntohs(addr.ss_family == AF_INET ? ((struct sockaddr_in *) &addr)->sin_port
+                                                  : ((struct sockaddr_in6 *) &addr)->sin6_port);
+    }
+    return MC_OK;
+}
+
+int
+stream_create(mc_stream **stream, mc_camera *cam, const char *address, int port, int n_slots, size_t capacity)
+{
+    struct epoll_event ev;
+    mc_stream *s;
+    int res;
+
+    *stream = NULL;
+    if (!(s = calloc(1, sizeof(mc_stream)))) goto ERR_MEMORY;
+    s->cam = cam;
+    s->listen_fd = s->epoll_fd = s->event_fd = -1;
+    atomic_init(&s->latest, -1);
+    if (!(s->slots = calloc(n_slots, sizeof(StreamSlot)))) goto ERR_MEMORY;
+    s->n_slots = n_slots;
+    for (int i=0; i<n_slots; i++) {
+        if (!(s->slots[i].data = malloc(capacity))) goto ERR_MEMORY;
+        s->slots[i].capacity = capacity;
+        atomic_init(&s->slots[i].refs, 0);
+    }
+
+    if ((res = stream_listen(s, address, port)) != MC_OK) {
+        stream_destroy(s);
+        return res;
+    }
+    s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    s->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->epoll_fd < 0 || s->event_fd < 0) {
+        mc_seterr(cam, MC_ERR_STREAM, "epoll/eventfd failure : %d, %s", errno, strerror(errno));
+        stream_destroy(s);
+        return MC_ERR_STREAM;
+    }
+    ev = (struct epoll_event){EPOLLIN, {.ptr = &LISTEN_TAG}};
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev);
+    ev = (struct epoll_event){EPOLLIN, {.ptr = &EVENT_TAG}};
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->event_fd, &ev);
+    *stream = s;
+    return MC_OK;
+
+    ERR_MEMORY:
+    stream_destroy(s);
+    mc_seterr(cam, MC_ERR_MEMORY, "Out of memory");
+    return MC_ERR_MEMORY;
+}
+
+int
+stream_start_server(mc_stream *s)
+{
+    int r = pthread_create(&s->server, NULL, server_worker, s);
+    if (r != 0) {
+        mc_seterr(s->cam, MC_ERR_STREAM, "Cannot start stream server : %d, %s", r, strerror(r));
+        return MC_ERR_STREAM;
+    }
+    s->server_started = 1;
+    return MC_OK;
+}
+
+/* Stop the server (the producer must have stopped) and free the stream */
+void
+stream_destroy(mc_stream *s)
+{
+    uint64_t one = 1;
+
+    if (!s) return;
+    atomic_store(&s->stop, 1);
+    if (s->server_started) {
+        if (write(s->event_fd, &one, sizeof(one)) < 0) {}
+        pthread_join(s->server, NULL);
+    }
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    if (s->epoll_fd >= 0) close(s->epoll_fd);
+    if (s->event_fd >= 0) close(s->event_fd);
+    if (s->unix_path) unlink(s->unix_path);
+    free(s->unix_path);
+    for (int i=0; s->slots && i<s->n_slots; i++) free(s->slots[i].data);
+    free(s->slots);
+    free(s->clients);
+    free(s);
+}
@@ -0,0 +1,57 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include "libmulticam.h"
+
+/* One frame of the ring. `refs` counts the clients currently sending it. */
+typedef struct StreamSlot {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint64_t seq;
+    mc_frame_info info;
+    atomic_int refs;
+} StreamSlot;
+
+typedef struct StreamClient StreamClient;
+
+/*
+ * MJPEG stream of one camera: the capture thread publishes payloads into a
+ * ring of slots (single producer), the server thread sends the latest slot to
+ * each client (many consumers) from an epoll loop.
+ */
+struct mc_stream {
+    mc_camera *cam;
+    StreamSlot *slots;
+    int n_slots;
+    atomic_int latest;          /* Most recently published slot, or -1 */
+    int next;                   /* Where the producer looks for a free slot */
+    uint64_t seq;               /* Frames published */
+    int listen_fd;
+    int epoll_fd;
+    int event_fd;               /* Wakes the server on new frames and on stop */
+    char *unix_path;
+    int port;
+    atomic_int stop;
+    atomic_int res;             /* Error that stopped the producer, or MC_OK */
+    pthread_t producer;
+    pthread_t server;
+    int producer_started;
+    int server_started;
+    StreamClient **clients;
+    int n_clients;
+    int cap_clients;
+    StreamClient *closed;       /* Closed clients, freed after each batch of events */
+    atomic_int stat_clients;
+    atomic_ullong stat_frames;
+    atomic_ullong stat_dropped;
+    atomic_ullong stat_sent;
+};
+
+int stream_create(mc_stream **stream, mc_camera *cam, const char *address, int port, int n_slots, size_t capacity);
+int stream_start_server(mc_stream *s);
+void stream_destroy(mc_stream *s);
+StreamSlot *stream_free_slot(mc_stream *s);
+void stream_publish(mc_stream *s, StreamSlot *slot);
+#endif //STREAM_H
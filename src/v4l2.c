@@ -1,5 +1,10 @@
-#include <Python.h>
 #include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -13,6 +18,27 @@
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+/* Record an error on the camera; the message is reported through mc_cam_error() */
+void mc_seterr(mc_camera *self, int err, const char *fmt, ...)
+{
+    va_list ap;
+
+    self->err = err;
+    va_start(ap, fmt);
+    vsnprintf(self->errmsg, MC_ERRMSG_LEN, fmt, ap);
+    va_end(ap);
+}
+
+static void v4l2_errmsg(char *errmsg, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!errmsg) return;
+    va_start(ap, fmt);
+    vsnprintf(errmsg, MC_ERRMSG_LEN, fmt, ap);
+    va_end(ap);
+}
+
 /*
  * Functions for v4l2 cameras.
  * This code is based partly on pyvideograb by Laurent Pointal at
@@ -34,12 +60,12 @@ int v4l2_xioctl (int fd, int request, void *arg)
 /* A wrapper around a VIDIOC_S_FMT ioctl to check for format compatibility */
 
 int
-v4l2_set_pixelformat(v4l2camObject *self, struct v4l2_format *fmt, unsigned long pixelformat)
+v4l2_set_pixelformat(mc_camera *self, struct v4l2_format *fmt, unsigned long pixelformat)
 {
     fmt->fmt.pix.pixelformat = pixelformat;
 
     if (-1 == v4l2_xioctl(self->fd, VIDIOC_S_FMT, fmt)) {
-        PyErr_Format(PyExc_SystemError, "%s: set_pixelformat failed (ioctl(VIDIOC_S_FMT))", self->device);
+        mc_seterr(self, MC_ERR_DEVICE, "%s: set_pixelformat failed (ioctl(VIDIOC_S_FMT))", self->device);
         return 0;
     }
 
@@ -47,7 +73,7 @@ v4l2_set_pixelformat(v4l2camObject *self, struct v4l2_format *fmt, unsigned long
         return 1;
     }
     else {
-        PyErr_Format(PyExc_SystemError, "%s: set_pixelformat failed (ioctl(VIDIOC_S_FMT))", self->device);
+        mc_seterr(self, MC_ERR_DEVICE, "%s: set_pixelformat failed (ioctl(VIDIOC_S_FMT))", self->device);
         return 0;
     }
 }
@@ -90,7 +116,7 @@ v4l2_set_control(int fd, int id, int value)
 
 
 int
-v4l2_query_buffer(v4l2camObject *self)
+v4l2_query_buffer(mc_camera *self)
 {
     unsigned int i;
 
@@ -104,7 +130,7 @@ v4l2_query_buffer(v4l2camObject *self)
         buf.index = i;
 
         if (-1 == v4l2_xioctl(self->fd, VIDIOC_QUERYBUF, &buf)) {
-            PyErr_Format(PyExc_MemoryError, "%s: ioctl(VIDIOC_QUERYBUF) failure : %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_MEMORY, "%s: ioctl(VIDIOC_QUERYBUF) failure : %d, %s", self->device, errno, strerror(errno));
             return 0;
         }
 
@@ -118,14 +144,14 @@ v4l2_query_buffer(v4l2camObject *self)
 }
 
 int
-v4l2_stop_capturing(v4l2camObject *self)
+v4l2_stop_capturing(mc_camera *self)
 {
     enum v4l2_buf_type type;
 
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
     if (-1 == v4l2_xioctl(self->fd, VIDIOC_STREAMOFF, &type)) {
-        PyErr_Format(PyExc_SystemError, "%s: ioctl(VIDIOC_STREAMOFF) failure : %d, %s", self->device, errno, strerror(errno));
+        mc_seterr(self, MC_ERR_STREAM, "%s: ioctl(VIDIOC_STREAMOFF) failure : %d, %s", self->device, errno, strerror(errno));
         return 0;
     }
 
@@ -133,7 +159,7 @@ v4l2_stop_capturing(v4l2camObject *self)
 }
 
 int
-v4l2_start_capturing(v4l2camObject *self)
+v4l2_start_capturing(mc_camera *self)
 {
     unsigned int i;
     enum v4l2_buf_type type;
@@ -148,7 +174,7 @@ v4l2_start_capturing(v4l2camObject *self)
         buf.index = i;
 
         if (-1 == v4l2_xioctl(self->fd, VIDIOC_QBUF, &buf)) {
-            PyErr_Format(PyExc_EnvironmentError, "%s: ioctl(VIDIOC_QBUF) failure : %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_STREAM, "%s: ioctl(VIDIOC_QBUF) failure : %d, %s", self->device, errno, strerror(errno));
             return 0;
         }
     }
@@ -156,7 +182,7 @@ v4l2_start_capturing(v4l2camObject *self)
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
     if (-1 == v4l2_xioctl(self->fd, VIDIOC_STREAMON, &type)) {
-        PyErr_Format(PyExc_EnvironmentError, "%s: ioctl(VIDIOC_STREAMON) failure : %d, %s", self->device, errno, strerror(errno));
+        mc_seterr(self, MC_ERR_STREAM, "%s: ioctl(VIDIOC_STREAMON) failure : %d, %s", self->device, errno, strerror(errno));
         return 0;
     }
 
@@ -164,24 +190,26 @@ v4l2_start_capturing(v4l2camObject *self)
 }
 
 int
-v4l2_uninit_device(v4l2camObject *self)
+v4l2_uninit_device(mc_camera *self)
 {
     unsigned int i;
 
     for (i = 0; i < self->n_buffers; ++i) {
         if (-1 == munmap(self->buffers[i].start, self->buffers[i].length)) {
-            PyErr_Format(PyExc_MemoryError, "%s: munmap failure: %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_MEMORY, "%s: munmap failure: %d, %s", self->device, errno, strerror(errno));
             return 0;
         }
     }
 
     free(self->buffers);
+    self->buffers = NULL;
+    self->n_buffers = 0;
 
     return 1;
 }
 
 int
-v4l2_init_mmap(v4l2camObject *self)
+v4l2_init_mmap(mc_camera *self)
 {
     struct v4l2_requestbuffers req;
 
@@ -196,24 +224,24 @@ v4l2_init_mmap(v4l2camObject *self)
 
     if (-1 == v4l2_xioctl(self->fd, VIDIOC_REQBUFS, &req)) {
         if (EINVAL == errno) {
-            PyErr_Format(PyExc_MemoryError, "%s does not support memory mapping",self->device);
+            mc_seterr(self, MC_ERR_MEMORY, "%s does not support memory mapping", self->device);
             return 0;
         }
         else {
-            PyErr_Format(PyExc_MemoryError, "%s: ioctl(VIDIOC_REQBUFS) failure : %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_MEMORY, "%s: ioctl(VIDIOC_REQBUFS) failure : %d, %s", self->device, errno, strerror(errno));
             return 0;
         }
     }
 
     if (req.count < 2) {
-        PyErr_Format(PyExc_MemoryError, "%s: Insufficient buffer memory\n", self->device);
+        mc_seterr(self, MC_ERR_MEMORY, "%s: Insufficient buffer memory\n", self->device);
         return 0;
     }
 
     self->buffers = calloc(req.count, sizeof(*self->buffers));
 
     if (!self->buffers) {
-        PyErr_Format(PyExc_MemoryError, "Out of memory");
+        mc_seterr(self, MC_ERR_MEMORY, "Out of memory");
         return 0;
     }
 
@@ -227,7 +255,7 @@ v4l2_init_mmap(v4l2camObject *self)
         buf.index = self->n_buffers;
 
         if (-1 == v4l2_xioctl(self->fd, VIDIOC_QUERYBUF, &buf)) {
-            PyErr_Format(PyExc_MemoryError, "%s: ioctl(VIDIOC_QUERYBUF) failure : %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_MEMORY, "%s: ioctl(VIDIOC_QUERYBUF) failure : %d, %s", self->device, errno, strerror(errno));
             // free(self->buffers);
             return 0;
         }
@@ -239,7 +267,7 @@ v4l2_init_mmap(v4l2camObject *self)
                  MAP_SHARED /* recommended */, self->fd, buf.m.offset);
 
         if (MAP_FAILED == self->buffers[self->n_buffers].start) {
-            PyErr_Format(PyExc_MemoryError, "%s: mmap failure : %d, %s", self->device, errno, strerror(errno));
+            mc_seterr(self, MC_ERR_MEMORY, "%s: mmap failure : %d, %s", self->device, errno, strerror(errno));
             return 0;
         }
     }
@@ -248,27 +276,27 @@ v4l2_init_mmap(v4l2camObject *self)
 }
 
 
-int v4l2_test_valid_device(int fd, char* device)
+int v4l2_test_valid_device(int fd, const char* device, char *errmsg)
 {
     struct v4l2_capability cap;
     if (-1 == v4l2_xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
         if (EINVAL == errno) {
-            PyErr_Format(PyExc_SystemError, "%s is not a V4L2 device", device);
+            v4l2_errmsg(errmsg, "%s is not a V4L2 device", device);
             return 0;
         }
         else {
-            PyErr_Format(PyExc_SystemError, "%s: ioctl(VIDIOC_QUERYCAP) failure : %d, %s", device, errno, strerror(errno));
+            v4l2_errmsg(errmsg, "%s: ioctl(VIDIOC_QUERYCAP) failure : %d, %s", device, errno, strerror(errno));
             return 0;
         }
     }
 
     if (!(cap.device_caps & V4L2_CAP_VIDEO_CAPTURE)) {
-        PyErr_Format(PyExc_SystemError, "%s is not a video capture device", device);
+        v4l2_errmsg(errmsg, "%s is not a video capture device", device);
         return 0;
     }
 
     if (!(cap.device_caps & V4L2_CAP_STREAMING)) {
-        PyErr_Format(PyExc_SystemError, "%s does not support streaming i/o", device);
+        v4l2_errmsg(errmsg, "%s does not support streaming i/o", device);
         return 0;
     }
     return 1;
@@ -279,17 +307,19 @@ struct v4l2_fract float2fract(float fps) {
     r = fmod(fps,1);
     if (r > 0) k = 1.0f/r;
     
-    printf("%f %f %i %i\n", fps, r, (unsigned int) k, (unsigned int) (k*fps));
     struct v4l2_fract res = {(unsigned int) k, (unsigned int) (k*fps)};
     return res;
 }
 
-int v4l2_init_device(v4l2camObject *self)
+int v4l2_init_device(mc_camera *self)
 {
 
     struct v4l2_format fmt;
 
-    if (!v4l2_test_valid_device(self->fd, self->device)) return 0;
+    if (!v4l2_test_valid_device(self->fd, self->device, self->errmsg)) {
+        self->err = MC_ERR_DEVICE;
+        return 0;
+    }
 
     CLEAR(fmt);
 
@@ -304,7 +334,7 @@ int v4l2_init_device(v4l2camObject *self)
 
     /* Note VIDIOC_S_FMT may change width and height. */
     if (((unsigned int) self->width != fmt.fmt.pix.width) || ( (unsigned int) self->height != fmt.fmt.pix.height)) {
-        PyErr_Format(PyExc_SystemError, "%s: Failed while setting size=(%d,%d). Got (%d,%d).", self->device, self->width, self->height, fmt.fmt.pix.width, fmt.fmt.pix.height);
+        mc_seterr(self, MC_ERR_DEVICE, "%s: Failed while setting size=(%d,%d). Got (%d,%d).", self->device, self->width, self->height, fmt.fmt.pix.width, fmt.fmt.pix.height);
         return 0;  
     }   
 
@@ -320,13 +350,13 @@ int v4l2_init_device(v4l2camObject *self)
     parm.parm.capture.timeperframe = targetfps;
     
     if (-1 == v4l2_xioctl(self->fd, VIDIOC_S_PARM, &parm)) {
-        PyErr_Format(PyExc_SystemError, "%s: Failed while setting fps=%S", self->device, PyFloat_FromDouble((double) self->fps));
+        mc_seterr(self, MC_ERR_DEVICE, "%s: Failed while setting fps=%g", self->device, (double) self->fps);
         return 0;
     }
     
     if ((parm.parm.capture.timeperframe.numerator != targetfps.numerator) || (parm.parm.capture.timeperframe.denominator != targetfps.denominator)) {
         float actualfps = 1.0*parm.parm.capture.timeperframe.denominator/parm.parm.capture.timeperframe.numerator;
-        PyErr_Format(PyExc_SystemError, "%s: Failed while setting fps=%S. Got %S.", self->device, PyFloat_FromDouble((double) self->fps), PyFloat_FromDouble((double) actualfps));
+        mc_seterr(self, MC_ERR_DEVICE, "%s: Failed while setting fps=%g. Got %g.", self->device, (double) self->fps, (double) actualfps);
         return 0;
     }
 
@@ -338,13 +368,13 @@ int v4l2_init_device(v4l2camObject *self)
 }
 
 int
-v4l2_close_device(v4l2camObject *self)
+v4l2_close_device(mc_camera *self)
 {
     if (self->fd == -1)
         return 1;
 
     if (-1 == close(self->fd)) {
-        PyErr_Format(PyExc_SystemError, "Cannot close '%s': %d, %s", self->device, errno, strerror(errno));
+        mc_seterr(self, MC_ERR_DEVICE, "Cannot close '%s': %d, %s", self->device, errno, strerror(errno));
         return 0;
     }
     self->fd = -1;
@@ -353,24 +383,24 @@ v4l2_close_device(v4l2camObject *self)
 }
 
 int
-v4l2_open_device(v4l2camObject *self)
+v4l2_open_device(mc_camera *self)
 {
     struct stat st;
 
     if (-1 == stat(self->device, &st)) {
-        PyErr_Format(PyExc_SystemError, "Cannot stat '%s': %d, %s", self->device, errno, strerror(errno));
+        mc_seterr(self, MC_ERR_DEVICE, "Cannot stat '%s': %d, %s", self->device, errno, strerror(errno));
         goto return_err;
     }
 
     if (!S_ISCHR(st.st_mode)) {
-        PyErr_Format(PyExc_SystemError, "%s is not a device", self->device);
+        mc_seterr(self, MC_ERR_DEVICE, "%s is not a device", self->device);
         goto return_err;
     }
 
     self->fd = open(self->device, O_RDWR, 0);
 
     if (-1 == self->fd) {
-        PyErr_Format(PyExc_SystemError, "Cannot open '%s': %d, %s", self->device, errno, strerror(errno));
+        mc_seterr(self, MC_ERR_DEVICE, "Cannot open '%s': %d, %s", self->device, errno, strerror(errno));
         goto return_err;
     }
     return 1;
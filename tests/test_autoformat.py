@@ -0,0 +1,70 @@
+'''
+plan_formats() with get_formats() and usb_topology() mocked, so no cameras
+are needed. Run with `python -m unittest discover tests` after building the
+extension.
+'''
+from pathlib import Path
+from unittest import TestCase, main, mock
+import warnings
+
+from multicam import autoformat, get_formats
+
+FORMATS = {
+    "YUYV": {"framesizes": {(640, 480): [30.0, 15.0], (1280, 720): [10.0]}},
+    "MJPG": {"framesizes": {(640, 480): [60.0, 30.0], (1280, 720): [30.0]}},
+    "H264": {"framesizes": {(640, 480): [30.0]}},
+}
+
+def usb2(bus):
+    return lambda dev: {"bus": bus, "speed": 480.0, "endpoint_limit": 3 * 1024 * 8000, "bus_budget": 0.8 * 480e6 / 8}
+
+class PlanFormatsTest(TestCase):
+    def plan(self, devs, topology=lambda dev: None, **kwargs):
+        with mock.patch.object(autoformat, "get_formats", return_value=FORMATS) as formats, \
+             mock.patch.object(autoformat, "usb_topology", side_effect=topology):
+            return autoformat.plan_formats(devs, **kwargs), formats
+
+    def test_integer_devices(self):
+        plan, formats = self.plan([0, "/dev/video2"])
+        formats.assert_any_call(Path("/dev/video0"))
+        formats.assert_any_call(Path("/dev/video2"))
+        self.assertEqual([c["dev"] for c in plan["cameras"]], [0, "/dev/video2"])
+
+    def test_cheapest_decode_without_usb(self):
+        plan, _ = self.plan([0])
+        self.assertEqual(plan["cameras"][0]["format"], "YUYV")
+        self.assertEqual(plan["cameras"][0]["fps"], 30.0)
+        self.assertIsNone(plan["cameras"][0]["rate"])
+        self.assertTrue(plan["fits"])
+
+    def test_decimation(self):
+        plan, _ = self.plan([0], size=(640, 480), fps=20)
+        self.assertEqual(plan["cameras"][0]["fps"], 30.0)
+        self.assertEqual(plan["cameras"][0]["rate"], 20)
+
+    def test_shared_bus(self):
+        plan, _ = self.plan([0, 1, 2], topology=usb2(1))
+        formats = [c["format"] for c in plan["cameras"]]
+        self.assertEqual(formats.count("MJPG"), 1) #Three YUYV streams exceed a USB 2.0 bus
+        self.assertTrue(plan["fits"])
+        self.assertEqual(plan["buses"][1]["cameras"], [0, 1, 2])
+        self.assertLessEqual(plan["buses"][1]["used"], plan["buses"][1]["budget"])
+
+    def test_over_budget(self):
+        with warnings.catch_warnings(record=True) as w:
+            warnings.simplefilter("always")
+            plan, _ = self.plan(list(range(8)), topology=usb2(1), formats=["YUYV"])
+        self.assertFalse(plan["fits"])
+        self.assertTrue(any("bandwidth" in str(x.message) for x in w))
+
+    def test_no_usable_format(self):
+        with self.assertRaises(ValueError):
+            self.plan([0], size=(320, 240))
+
+class GetFormatsTest(TestCase):
+    def test_invalid_device_type(self):
+        with self.assertRaises(TypeError):
+            get_formats(0)
+
+if __name__ == "__main__":
+    main()
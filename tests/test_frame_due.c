@@ -0,0 +1,98 @@
+/*
+ * Rate decimation of cam_frame_due(), without cameras. Run with `make test`.
+ * The library source is included to reach the static function.
+ */
+#include "libmulticam.c"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static void
+cam_setup(mc_camera *cam, float fps, float rate)
+{
+    memset(cam, 0, sizeof(*cam));
+    cam->fps = fps;
+    cam->rate = rate;
+}
+
+/* Number of due frames among `n` frames `interval_us` apart, from `start_us` */
+static int
+count_due(mc_camera *cam, uint64_t start_us, uint64_t interval_us, int n)
+{
+    int due = 0;
+    for (int i=0; i<n; i++)
+        due += cam_frame_due(cam, start_us + i*interval_us);
+    return due;
+}
+
+static void
+test_every_frame(void)
+{
+    mc_camera cam;
+    cam_setup(&cam, 60, 0);
+    CHECK(count_due(&cam, 1000000, 16667, 60) == 60);
+}
+
+static void
+test_decimation(void)
+{
+    mc_camera cam;
+    cam_setup(&cam, 60, 15);
+    CHECK(count_due(&cam, 1000000, 16667, 60) == 15); //Every 4th frame
+    cam_setup(&cam, 30, 10);
+    CHECK(count_due(&cam, 1000000, 33333, 90) == 30); //Every 3rd frame
+    cam_setup(&cam, 30, 30);
+    CHECK(count_due(&cam, 1000000, 33333, 30) == 30); //Rate of the sensor
+}
+
+static void
+test_jitter(void)
+{
+    mc_camera cam;
+    cam_setup(&cam, 30, 15); //Period 66666 us, tolerance 16666 us
+    CHECK(cam_frame_due(&cam, 1000000));
+    CHECK(cam_frame_due(&cam, 1066666 - 5000));    //Slightly early
+    CHECK(!cam_frame_due(&cam, 1133332 - 20000));  //More than half a sensor frame early
+    CHECK(cam_frame_due(&cam, 1133332 + 5000));    //Slightly late
+    CHECK(cam.next_due_us == 1199998);              //Keeps the schedule instead of drifting
+
+    //Jittered timestamps still give the target rate
+    cam_setup(&cam, 30, 15);
+    int due = 0;
+    for (int i=0; i<90; i++)
+        due += cam_frame_due(&cam, 1000000 + i*33333 + ((i % 2) ? 4000 : -4000));
+    CHECK(due == 45);
+}
+
+static void
+test_catch_up(void)
+{
+    mc_camera cam;
+    cam_setup(&cam, 60, 15);
+    CHECK(count_due(&cam, 1000000, 16667, 8) == 2);
+    //Frames stopped for a second: the next one is due, without a burst to make up for the gap
+    CHECK(cam_frame_due(&cam, 2200000));
+    CHECK(cam.next_due_us == 2200000 + 66666);
+    CHECK(count_due(&cam, 2200000 + 16667, 16667, 59) == 14);
+}
+
+int
+main(void)
+{
+    test_every_frame();
+    test_decimation();
+    test_jitter();
+    test_catch_up();
+    if (failures) {
+        fprintf(stderr, "test_frame_due: %d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("test_frame_due: OK\n");
+    return 0;
+}